@@ -3,16 +3,29 @@
  * Copyright 2019 Hans de Goede <hdegoede@redhat.com>
  */
 
+#include <linux/debugfs.h>
+#include <linux/highmem.h>
+#include <linux/hrtimer.h>
 #include <linux/module.h>
 #include <linux/pm.h>
+#include <linux/ratelimit.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/usb.h>
+#include <linux/vmalloc.h>
+#include <linux/xxhash.h>
 
+#include <drm/drm_atomic.h>
 #include <drm/drm_atomic_helper.h>
 #include <drm/drm_atomic_state_helper.h>
+#include <drm/drm_blend.h>
 #include <drm/drm_connector.h>
+#include <drm/drm_crtc.h>
 #include <drm/drm_damage_helper.h>
+#include <drm/drm_debugfs.h>
 #include <drm/drm_drv.h>
 #include <drm/drm_edid.h>
+#include <drm/drm_encoder.h>
 #include <drm/drm_fb_helper.h>
 #include <drm/drm_file.h>
 #include <drm/drm_format_helper.h>
@@ -24,11 +37,20 @@
 #include <drm/drm_ioctl.h>
 #include <drm/drm_managed.h>
 #include <drm/drm_modeset_helper_vtables.h>
+#include <drm/drm_plane_helper.h>
+#include <drm/drm_prime.h>
 #include <drm/drm_probe_helper.h>
+#include <drm/drm_rect.h>
 #include <drm/drm_simple_kms_helper.h>
+#include <drm/drm_vblank.h>
 
 #include "statusLinkProtocol.h"
 #include "panelLinkProtocol.h"
+#include "beada_convert.h"
+#include "beada_sched.h"
+
+#define CREATE_TRACE_POINTS
+#include "beada_trace.h"
 
 #define DRIVER_NAME		"beada"
 #define DRIVER_DESC		"BeadaPanel USB Media Display"
@@ -57,10 +79,258 @@
 #define DATA_TIMEOUT			msecs_to_jiffies(1000)
 #define PANELLINK_MAX_DELAY		msecs_to_jiffies(1000)
 #define CMD_SIZE			512*4
+#define BEADA_FRAME_COUNT		3
+#define BEADA_MAX_CLIPS			8
+#define BEADA_TAG_SIZE			512
+#define BEADA_TILE_SIZE			16
+#define BEADA_BAND_BACKOFF		7
+#define BEADA_SNAP_SIZE			64
+#define BEADA_TAG_COST			4096
+#define BEADA_MAX_STRIPES		8
+#define BEADA_MAX_CHUNKS		BEADA_MAX_STRIPES
+#define BEADA_TAG_CACHE			16
+#define BEADA_MAP_CACHE			4
+#define BEADA_TRACE_ENTRIES		32
+#define BEADA_TRACE_BYTES		288
+#define BEADA_HIST_BUCKETS		24
+#define BEADA_ERRNO_MAX			128
+#define BEADA_CURSOR_SIZE		64
+#define BEADA_OVERLAYS			2
+#define BEADA_LAYERS			(BEADA_OVERLAYS + 1)
+
+static unsigned int tag_cost;
+module_param(tag_cost, uint, 0644);
+MODULE_PARM_DESC(tag_cost, "Bus cost of a PanelLink start tag in pixel bytes, 0 to measure it on the link (default 0)");
+
+static bool map_cache = true;
+module_param(map_cache, bool, 0644);
+MODULE_PARM_DESC(map_cache, "Keep recently flushed framebuffers mapped between frames (default true)");
+
+static bool tile_diff = true;
+module_param(tile_diff, bool, 0644);
+MODULE_PARM_DESC(tile_diff, "Only send tiles that differ from what the panel shows (default true)");
+
+static bool band_hash = true;
+module_param(band_hash, bool, 0644);
+MODULE_PARM_DESC(band_hash, "Skip the tile compare for tile rows whose content hash is unchanged (default true)");
+
+static unsigned int stripe_rows = 64;
+module_param(stripe_rows, uint, 0644);
+MODULE_PARM_DESC(stripe_rows, "Minimum rows per parallel conversion stripe, 0 to convert on one CPU (default 64)");
+
+static unsigned int stream_rows = 32;
+module_param(stream_rows, uint, 0644);
+MODULE_PARM_DESC(stream_rows, "Minimum rows per streamed transfer without tile_diff, 0 to send whole rects (default 32)");
+
+static unsigned int max_fps;
+module_param(max_fps, uint, 0644);
+MODULE_PARM_DESC(max_fps, "Initial per-panel cap on flushes per second, 0 for none (default 0)");
+
+static unsigned int vblank_hz;
+module_param(vblank_hz, uint, 0644);
+MODULE_PARM_DESC(vblank_hz, "Emulated vblank rate in Hz, 0 to follow the mode (default 0)");
+
+struct beada_device;
+
+/* damage clips of one update, in upload order */
+struct beada_damage {
+	struct drm_rect		clips[BEADA_MAX_CLIPS];
+	unsigned int		num_clips;
+};
+
+enum beada_frame_state {
+	BEADA_FRAME_FREE,
+	BEADA_FRAME_FILLING,
+	BEADA_FRAME_QUEUED,
+	BEADA_FRAME_BUSY,
+};
+
+/*
+ * A frame buffer together with the pre-allocated URBs used to send it.
+ * Pixel data of all clips is packed back to back in buf, and every clip
+ * goes out as its own transfer, preceded by a PanelLink start tag whenever
+ * its geometry differs from what the panel received last. On hosts with
+ * scatter-gather support buf is virtually contiguous only, clips start on
+ * a page boundary and are sent through sg tables over pages.
+ */
+struct beada_frame {
+	struct beada_device	*beada;
+	enum beada_frame_state	state;
+	struct beada_damage	damage;
+	ktime_t			submitted;
+	ktime_t			committed;
+	unsigned int		urbs_pending;
+	unsigned int		seq;
+
+	/* completion of the previous transfer and a start tag's share, for beada_link */
+	ktime_t			last_done;
+	u32			tag_ns;
+	bool			streamed;
+
+	/* the first pixels reached the panel, for the first_pixels histogram */
+	bool			pixels_sent;
+
+	unsigned char		*buf;
+	struct page		**pages;
+	struct urb		*urbs[BEADA_MAX_CLIPS];
+
+	/*
+	 * Clips sent straight from the framebuffer's shmem pages have an sg
+	 * table too, but no data in buf; the frame then holds a reference on
+	 * the framebuffer and its mapping until it is reused.
+	 */
+	struct sg_table		sgt[BEADA_MAX_CLIPS];
+	struct drm_framebuffer	*fb;
+	struct dma_buf_map	map[DRM_FORMAT_MAX_PLANES];
+
+	/*
+	 * Only without tile_diff: the shmem pages are read when the URB runs,
+	 * and the shadow must match what the panel got, not what the pages
+	 * hold by then.
+	 */
+	bool			zero_copy;
+
+	unsigned char		*tag_buf;
+	struct urb		*tag_urbs[BEADA_MAX_CLIPS];
+	int			tag_width[BEADA_MAX_CLIPS];
+	int			tag_height[BEADA_MAX_CLIPS];
+
+	/*
+	 * Streamed clips go out in chunks; the last one of each clip is sent
+	 * through its URB in urbs, the ones before take URBs from this pool.
+	 */
+	struct urb		*chunk_urbs[BEADA_MAX_CHUNKS];
+	struct sg_table		chunk_sgt[BEADA_MAX_CHUNKS];
+	unsigned int		num_chunks;
+
+	/* page flip completed on the first vblank after the frame went out */
+	struct drm_pending_vblank_event	*event;
+};
+
+/*
+ * The panel has a single framebuffer, so overlay and cursor planes are
+ * blended into the RGB565 stream by the driver. A layer holds a reference
+ * on its plane's framebuffer and mapping, rect is where it goes on screen
+ * and src_x/src_y the framebuffer pixel shown at its top left.
+ */
+struct beada_layer {
+	struct drm_framebuffer	*fb;
+	struct dma_buf_map	map[DRM_FORMAT_MAX_PLANES];
+	struct dma_buf_map	data[DRM_FORMAT_MAX_PLANES];
+	struct drm_rect		rect;
+	int			src_x;
+	int			src_y;
+};
+
+/*
+ * Last part of a tile row written to the shadow and the xxh64 of its
+ * converted pixels. A rect that comes back with the same hash is taken as
+ * unchanged without comparing it against the shadow. Hashing a band that
+ * changed costs on top of the compare, so after a change the next few
+ * diffs of the band (skip) compare only.
+ */
+struct beada_band {
+	struct drm_rect		rect;
+	u64			hash;
+	unsigned int		skip;
+};
+
+/* PanelLink start tag built for one rect geometry, kept in LRU order */
+struct beada_tag {
+	struct list_head	lru;
+	int			width;
+	int			height;
+	u32			format;
+	unsigned int		len;
+	unsigned char		buf[BEADA_TAG_SIZE];
+};
+
+/* recently used framebuffer, with a reference on it and its mapping */
+struct beada_map {
+	struct list_head	lru;
+	struct drm_framebuffer	*fb;
+	struct dma_buf_map	map[DRM_FORMAT_MAX_PLANES];
+};
+
+/* horizontal band of a rect, converted on its own CPU */
+struct beada_stripe {
+	struct work_struct		work;
+	void				*dst;
+	const struct dma_buf_map	*map;
+	struct drm_framebuffer		*fb;
+	struct drm_rect			clip;
+};
+
+#ifdef BEADA_PROTO_TRACE
+/* one PanelLink/StatusLink message, as seen on the wire */
+struct beada_trace_entry {
+	ktime_t			time;
+	const char		*what;
+	bool			out;
+	unsigned int		len;
+	u8			data[BEADA_TRACE_BYTES];
+};
+#endif
+
+/* log2 buckets of microseconds, bucket n holds [2^(n-1), 2^n) */
+struct beada_hist {
+	unsigned long		buckets[BEADA_HIST_BUCKETS];
+};
+
+/*
+ * Cost of the bulk link as measured from URB completions of frames sent in
+ * one go: time per start tag, including the panel's pause before it takes
+ * pixels again, and time per pixel byte. The fit_ fields are running means
+ * of length, time and their products over clips right after a tag, for a
+ * least squares fit of the two. Protected by frame_lock.
+ */
+struct beada_link {
+	u32			tag_ns;
+	u32			byte_ps;
+	u64			fit_len;
+	u64			fit_ns;
+	u64			fit_len2;
+	u64			fit_len_ns;
+};
+
+struct beada_stats {
+	unsigned long		frames;
+	unsigned long		frames_dropped;
+	unsigned long		frames_streamed;
+	unsigned long		commits_coalesced;
+	unsigned long		clips;
+	unsigned long		tag_hits;
+	unsigned long		tag_misses;
+	unsigned long		uploads_split;
+	unsigned long		uploads_merged;
+	unsigned long		uploads_snapped;
+	unsigned long		bytes_unchanged;
+	unsigned long		bytes_hashed;
+	unsigned long		flushes_skipped;
+	unsigned long		bytes_zero_copy;
+	unsigned long		bytes_sent;
+	unsigned long		tags_sent;
+	unsigned long		map_hits;
+	unsigned long		map_misses;
+	ktime_t			since;
+
+	/* failed transfers by errno, anything beyond BEADA_ERRNO_MAX in 0 */
+	unsigned long		errors[BEADA_ERRNO_MAX];
+
+	struct beada_hist	map_us;
+	struct beada_hist	convert_us;
+	struct beada_hist	transfer_us;
+	struct beada_hist	first_pixels_us;
+	struct beada_hist	latency_us;
+};
 
 struct beada_device {
 	struct drm_device				dev;
-	struct drm_simple_display_pipe	pipe;
+	struct drm_plane				primary;
+	struct drm_plane				overlays[BEADA_OVERLAYS];
+	struct drm_plane				cursor_plane;
+	struct drm_crtc					crtc;
+	struct drm_encoder				encoder;
 	struct drm_connector			conn;
 	struct usb_device				*udev;
 	struct device					*dmadev;
@@ -69,7 +339,7 @@ struct beada_device {
 	unsigned int screen;
 	unsigned int version;
 	unsigned char id[8];
-	char *model;
+	const char *model;
 
 	unsigned int	width;
 	unsigned int	height;
@@ -77,7 +347,96 @@ struct beada_device {
 	unsigned int	width_mm;
 	unsigned int	height_mm;
 	unsigned char	*cmd_buf;
-	unsigned char	*draw_buf;
+	struct edid	edid;
+
+	struct usb_anchor	anchor;
+	struct beada_frame	frames[BEADA_FRAME_COUNT];
+
+	/*
+	 * Frame ring, protected by frame_lock. At most one frame is on the
+	 * bus; the newest converted frame waits in the frame_queued mailbox
+	 * and replaces any older one still waiting there.
+	 */
+	spinlock_t		frame_lock;
+	wait_queue_head_t	frame_wait;
+	struct beada_frame	*frame_busy;
+	struct beada_frame	*frame_queued;
+	int			frame_error;
+	unsigned int		frame_seq;
+	struct beada_link	link;
+
+	/*
+	 * Damage recorded by atomic commits and not yet picked up by the
+	 * flush worker, which owns all PanelLink traffic. Commits landing
+	 * while the worker is busy are merged into one upload. While a
+	 * commit is being applied (open), the worker leaves its damage alone
+	 * until atomic_flush has stored the page flip event with it.
+	 */
+	struct {
+		struct mutex			lock;
+		struct delayed_work		work;
+		struct drm_framebuffer		*fb;
+		struct dma_buf_map		map[DRM_FORMAT_MAX_PLANES];
+		struct dma_buf_map		data[DRM_FORMAT_MAX_PLANES];
+		struct beada_damage		damage;
+		struct drm_pending_vblank_event	*event;
+		ktime_t				committed;
+		bool				resync;
+		bool				open;
+		struct beada_layer		layers[BEADA_LAYERS];
+		bool				layers_changed;
+	} fb_update;
+	struct workqueue_struct	*wq;
+	unsigned int		max_fps;
+	ktime_t			last_flush;
+
+	/* the panel has no scanout timing of its own, vblank is emulated */
+	struct hrtimer		vblank_timer;
+	ktime_t			vblank_period;
+	bool			vblank_enabled;
+
+	/* turns on the bus, shared with other panels behind the same external hub */
+	struct beada_sched_client	sched;
+
+	/*
+	 * RGB565 copy of what the panel currently shows, only touched by the
+	 * flush worker. Damage is converted into conv_buf first and compared
+	 * against it tile by tile.
+	 */
+	u8			*shadow;
+	u8			*conv_buf;
+	struct beada_band	*bands;
+	bool			shadow_valid;
+
+	/* overlays and cursor as blended by the flush worker, in zpos order */
+	struct beada_layer	layers[BEADA_LAYERS];
+
+	/* stripes of the rect being converted, owned by the flush worker */
+	struct beada_stripe	stripes[BEADA_MAX_STRIPES];
+	unsigned int		num_stripes;
+	bool			stripes_queued;
+
+	/* start tags of recently sent geometries, owned by the flush worker */
+	struct list_head	tag_lru;
+	struct beada_tag	tags[BEADA_TAG_CACHE];
+
+	/*
+	 * Framebuffers flushed lately stay mapped, so flipping between them
+	 * or a plane coming back to one does not map and unmap it each time.
+	 */
+	struct mutex		map_lock;
+	struct list_head	map_lru;
+	struct beada_map	maps[BEADA_MAP_CACHE];
+
+	struct beada_stats	stats;
+
+#ifdef BEADA_PROTO_TRACE
+	/* last protocol messages, dumped by the "protocol" debugfs file */
+	spinlock_t			trace_lock;
+	struct beada_trace_entry	trace[BEADA_TRACE_ENTRIES];
+	unsigned int			trace_head;
+	struct ratelimit_state		trace_rs;
+#endif
 
 	int		old_rect_x1;
 	int		old_rect_y1;
@@ -91,292 +450,2271 @@ struct beada_device {
 
 #define to_beada(__dev) container_of(__dev, struct beada_device, dev)
 
-void HexDump(unsigned char *buf, int len, unsigned char *addr) {
-	int i, j, k;
-	char binstr[80];
+static void beada_hist_add(struct beada_hist *hist, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
 
-	for (i = 0; i < len; i++) {
-		if (0 == (i % 16)) {
-			sprintf(binstr, "%08x -", i + (int)addr);
-			sprintf(binstr, "%s %02x", binstr, (unsigned char)buf[i]);
-		}
-		else if (15 == (i % 16)) {
-			sprintf(binstr, "%s %02x", binstr, (unsigned char)buf[i]);
-			sprintf(binstr, "%s  ", binstr);
-			for (j = i - 15; j <= i; j++) {
-				sprintf(binstr, "%s%c", binstr, ('!' < buf[j] && buf[j] <= '~') ? buf[j] : '.');
-			}
-			printk(KERN_DEBUG "%s\n", binstr);
-		}
-		else {
-			sprintf(binstr, "%s %02x", binstr, (unsigned char)buf[i]);
+	hist->buckets[min_t(unsigned int, fls64(max_t(s64, us, 0)), BEADA_HIST_BUCKETS - 1)]++;
+}
+
+/*
+ * Complete a page flip on the next emulated vblank, along with the vblank
+ * reference taken when the event was picked up from the commit.
+ */
+static void beada_vblank_arm(struct beada_device *beada, struct drm_pending_vblank_event *event)
+{
+	unsigned long flags;
+
+	if (!event)
+		return;
+
+	spin_lock_irqsave(&beada->dev.event_lock, flags);
+	drm_crtc_arm_vblank_event(&beada->crtc, event);
+	spin_unlock_irqrestore(&beada->dev.event_lock, flags);
+}
+
+/* the frame is off the bus or never going to be, called with frame_lock held */
+static void beada_frame_flip(struct beada_device *beada, struct beada_frame *frame)
+{
+	beada_vblank_arm(beada, frame->event);
+	frame->event = NULL;
+}
+
+/* record a failed transfer, called with frame_lock held */
+static void beada_frame_fail(struct beada_device *beada, int err)
+{
+	beada->frame_error = err;
+	beada->stats.errors[err < 0 && -err < BEADA_ERRNO_MAX ? -err : 0]++;
+}
+
+#ifdef BEADA_PROTO_TRACE
+static void beada_proto_trace_init(struct beada_device *beada)
+{
+	spin_lock_init(&beada->trace_lock);
+	ratelimit_state_init(&beada->trace_rs, HZ, 10);
+}
+
+/*
+ * Record a protocol message in the trace ring. Safe from URB completion
+ * context; messages longer than BEADA_TRACE_BYTES are truncated.
+ */
+static void beada_proto_trace(struct beada_device *beada, const char *what, bool out,
+			      const void *buf, unsigned int len)
+{
+	struct beada_trace_entry *entry;
+	unsigned long flags;
+
+	spin_lock_irqsave(&beada->trace_lock, flags);
+	entry = &beada->trace[beada->trace_head++ % BEADA_TRACE_ENTRIES];
+	entry->time = ktime_get();
+	entry->what = what;
+	entry->out = out;
+	entry->len = len;
+	memcpy(entry->data, buf, min_t(unsigned int, len, BEADA_TRACE_BYTES));
+	spin_unlock_irqrestore(&beada->trace_lock, flags);
+
+	if (__ratelimit(&beada->trace_rs))
+		dev_dbg(&beada->udev->dev, "%s %s, %u bytes: %*ph\n", out ? ">" : "<",
+			what, len, min_t(int, len, 32), buf);
+}
+#else
+static inline void beada_proto_trace_init(struct beada_device *beada) { }
+static inline void beada_proto_trace(struct beada_device *beada, const char *what, bool out,
+				     const void *buf, unsigned int len) { }
+#endif
+
+/*
+ * Find the start tag for a rect geometry, building it in place of the
+ * least recently used one if it is not cached. @format is the wire format,
+ * which is RGB565 for now.
+ */
+static struct beada_tag *beada_tag_lookup(struct beada_device *beada, int width, int height,
+					  u32 format)
+{
+	char fmtstr[256] = {0};
+	struct beada_tag *tag;
+	int ret;
+
+	list_for_each_entry(tag, &beada->tag_lru, lru) {
+		if (tag->width == width && tag->height == height && tag->format == format) {
+			list_move(&tag->lru, &beada->tag_lru);
+			beada->stats.tag_hits++;
+			return tag;
 		}
 	}
-	if (0 != (i % 16)) {
-		k = 16 - (i % 16);
-		for (j = 0; j < k; j++) {
-			sprintf(binstr, "%s   ", binstr);
-		}
-		sprintf(binstr, "%s  ", binstr);
-		k = 16 - k;
-		for (j = i - k; j < i; j++) {
-			sprintf(binstr, "%s%c", binstr, ('!' < buf[j] && buf[j] <= '~') ? buf[j] : '.');
-		}
-		printk(KERN_DEBUG "%s\n", binstr);
+
+	tag = list_last_entry(&beada->tag_lru, struct beada_tag, lru);
+	list_move(&tag->lru, &beada->tag_lru);
+	beada->stats.tag_misses++;
+
+	tag->len = BEADA_TAG_SIZE;
+	snprintf(fmtstr, sizeof(fmtstr), "video/x-raw, format=RGB16, height=%d, width=%d, framerate=0/1", height, width);
+
+	/* prepare tag header */
+	ret = fillPLStart(tag->buf, &tag->len, fmtstr);
+	if (ret) {
+		DRM_DEV_ERROR(&beada->udev->dev, "fillPLStart() error %d\n", ret);
+		tag->width = 0;
+		tag->height = 0;
+		return ERR_PTR(-EIO);
+	}
+
+	tag->width = width;
+	tag->height = height;
+	tag->format = format;
+
+	return tag;
+}
+
+static void beada_tag_cache_init(struct beada_device *beada)
+{
+	int i;
+
+	/* zero sized entries never match a rect */
+	INIT_LIST_HEAD(&beada->tag_lru);
+	for (i = 0; i < BEADA_TAG_CACHE; i++)
+		list_add_tail(&beada->tags[i].lru, &beada->tag_lru);
+}
+
+/* build the PanelLink start tag for a clip geometry, unless already there */
+static int beada_frame_tag(struct beada_device *beada, struct beada_frame *frame, unsigned int i)
+{
+	struct beada_tag *tag;
+	int width, height;
+
+	width = drm_rect_width(&frame->damage.clips[i]);
+	height = drm_rect_height(&frame->damage.clips[i]);
+	if (frame->tag_width[i] == width && frame->tag_height[i] == height)
+		return 0;
+
+	tag = beada_tag_lookup(beada, width, height, DRM_FORMAT_RGB565);
+	if (IS_ERR(tag)) {
+		frame->tag_width[i] = 0;
+		frame->tag_height[i] = 0;
+		return PTR_ERR(tag);
 	}
+
+	/* the cached tag may be rebuilt while this frame is on the bus */
+	memcpy(frame->tag_buf + i * BEADA_TAG_SIZE, tag->buf, tag->len);
+	frame->tag_urbs[i]->transfer_buffer_length = tag->len;
+	frame->tag_width[i] = width;
+	frame->tag_height[i] = height;
+
+	return 0;
+}
+
+/* panel geometry by the os_version StatusLink reports */
+struct beada_model {
+	unsigned char	os_version;
+	const char	*name;
+	int		width;
+	int		height;
+	int		width_mm;
+	int		height_mm;
+};
+
+static const struct beada_model beada_models[] = {
+	{ MODEL_5,  "5",  800,  480, 108, 65 },
+	{ MODEL_2,  "2",  480,  480,  53, 53 },
+	{ MODEL_2W, "2W", 480,  480,  70, 70 },
+	{ MODEL_3,  "3",  480,  320,  62, 40 },
+	{ MODEL_3C, "3C", 480,  320,  62, 40 },
+	{ MODEL_4,  "4",  800,  480,  94, 56 },
+	{ MODEL_4C, "4C", 800,  480,  94, 56 },
+	{ MODEL_5S, "5S", 800,  480, 108, 65 },
+	{ MODEL_6,  "6",  1280, 480, 161, 60 },
+	{ MODEL_6C, "6C", 1280, 480, 161, 60 },
+	{ MODEL_6S, "6S", 1280, 480, 161, 60 },
+	{ MODEL_7C, "7C", 800,  480,  62, 110 },
+};
+
+/* panels this driver does not know are taken for a Model 5 */
+static const struct beada_model *beada_model_find(unsigned char os_version)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(beada_models); i++)
+		if (beada_models[i].os_version == os_version)
+			return &beada_models[i];
+
+	return &beada_models[0];
 }
 
-static int beada_send_tag(struct beada_device *beada, const char* cmd)
+static int beada_misc_request(struct beada_device *beada)
 {
 	int ret;
 	unsigned int len, len1;
+	const struct beada_model *model;
 
 	len = CMD_SIZE;
 
-	/* prepare tag header */
-	ret = fillPLStart(beada->draw_buf, &len, cmd);	
+	// prepare statuslink command
+	ret = fillSLGetInfo(beada->cmd_buf, &len);
 	if (ret) {
-		DRM_DEV_ERROR(&beada->udev->dev, "fillPLStart() error %d\n", ret);
+		DRM_DEV_ERROR(&beada->udev->dev, "fillSLGetInfo() error %d\n", ret);
 		return -EIO;
 	}
 
-	HexDump(beada->draw_buf, len, beada->draw_buf);
+	beada_proto_trace(beada, "StatusLink get info", true, beada->cmd_buf, len);
 
 	/* send request */
 	ret = usb_bulk_msg(beada->udev,
-			usb_sndbulkpipe(beada->udev, beada->data_snd_ept),
-			beada->draw_buf, len, &len1, CMD_TIMEOUT);
+			usb_sndbulkpipe(beada->udev, beada->misc_snd_ept),
+			beada->cmd_buf, len, &len1, CMD_TIMEOUT);
+
+	if (ret || len1 != len) {
+		DRM_DEV_ERROR(&beada->udev->dev, "usb_bulk_msg() write error %d\n", ret);
+		return -EIO;
+	}
+
+	/* read value */
+	len += sizeof(STATUSLINK_INFO);
+	ret = usb_bulk_msg(beada->udev,
+			usb_rcvbulkpipe(beada->udev, beada->misc_rcv_ept),
+			beada->cmd_buf, len, &len1,
+			DATA_TIMEOUT);
+	if (ret || len1 != len) {
+		DRM_DEV_ERROR(&beada->udev->dev, "usb_bulk_msg() read error %d\n", ret);
+		return -EIO;
+	}
 
-	if (ret || len != len1) {
-		DRM_DEV_ERROR(&beada->udev->dev, "usb_bulk_msg() error %d\n", ret);
+	beada_proto_trace(beada, "StatusLink info", false, beada->cmd_buf, len);
+
+	/* retrive BeadaPanel device info into a local structure */
+	ret = retrivSLGetInfo(beada->cmd_buf, len, &beada->info);
+	if (ret) {
+		DRM_DEV_ERROR(&beada->udev->dev, "retrivSLGetInfo() error %d\n", ret);
 		return -EIO;
 	}
 
+	model = beada_model_find(beada->info.os_version);
+	beada->width = model->width;
+	beada->height = model->height;
+	beada->margin = 0;
+	beada->model = model->name;
+	beada->width_mm = model->width_mm;
+	beada->height_mm = model->height_mm;
+
 	return 0;
 }
 
-static int beada_misc_request(struct beada_device *beada)
+static size_t beada_rect_bytes(const struct drm_rect *rect)
+{
+	return drm_rect_width(rect) * drm_rect_height(rect) * RGB565_BPP / 8;
+}
+
+static size_t beada_damage_bytes(const struct beada_damage *damage)
 {
+	size_t bytes = 0;
+	unsigned int i;
+
+	for (i = 0; i < damage->num_clips; i++)
+		bytes += beada_rect_bytes(&damage->clips[i]);
+
+	return bytes;
+}
+
+static void beada_stripe_convert(struct beada_stripe *stripe)
+{
+	const struct dma_buf_map *map = stripe->map;
+	struct drm_framebuffer *fb = stripe->fb;
+
+	if (fb->format->format == DRM_FORMAT_RGB565)
+		drm_fb_memcpy(stripe->dst, map->vaddr, fb, &stripe->clip);
+	else if (!beada_convert_xrgb8888_to_rgb565(stripe->dst, map->vaddr, fb->pitches[0],
+						   &stripe->clip))
+		drm_fb_xrgb8888_to_rgb565(stripe->dst, map->vaddr, fb, &stripe->clip, false);
+}
+
+static void beada_stripe_work(struct work_struct *work)
+{
+	beada_stripe_convert(container_of(work, struct beada_stripe, work));
+}
+
+/* stripes to convert @clip in, at least stripe_rows rows each */
+static unsigned int beada_stripes_count(const struct drm_rect *clip)
+{
+	unsigned int rows = READ_ONCE(stripe_rows);
+
+	if (!rows)
+		return 1;
+
+	return clamp(drm_rect_height(clip) / rows, 1U,
+		     min_t(unsigned int, BEADA_MAX_STRIPES, num_online_cpus()));
+}
+
+/*
+ * Split a rect into @n row stripes. With @parallel they start converting
+ * on the unbound workqueue right away, otherwise each is converted when
+ * beada_stripe_wait() gets to it.
+ */
+static void beada_stripes_start(struct beada_device *beada, void *dst,
+				const struct dma_buf_map *map, struct drm_framebuffer *fb,
+				const struct drm_rect *clip, unsigned int n, bool parallel)
+{
+	unsigned int height = drm_rect_height(clip);
+	unsigned int pitch = drm_rect_width(clip) * RGB565_BPP / 8;
+	struct beada_stripe *stripe;
+	unsigned int i;
+	int y1, y2;
+
+	beada->num_stripes = n;
+	beada->stripes_queued = parallel && n > 1;
+
+	for (i = 0; i < n; i++) {
+		stripe = &beada->stripes[i];
+		y1 = clip->y1 + height * i / n;
+		y2 = clip->y1 + height * (i + 1) / n;
+
+		stripe->dst = dst + (y1 - clip->y1) * pitch;
+		stripe->map = map;
+		stripe->fb = fb;
+		drm_rect_init(&stripe->clip, clip->x1, y1, drm_rect_width(clip), y2 - y1);
+
+		if (beada->stripes_queued)
+			queue_work(system_unbound_wq, &stripe->work);
+	}
+}
+
+/* wait for stripe @i, so callers can consume finished stripes in order */
+static struct beada_stripe *beada_stripe_wait(struct beada_device *beada, unsigned int i)
+{
+	struct beada_stripe *stripe = &beada->stripes[i];
+
+	if (beada->stripes_queued)
+		flush_work(&stripe->work);
+	else
+		beada_stripe_convert(stripe);
+
+	return stripe;
+}
+
+/* ------------------------------------------------------------------ */
+/* beada map cache						      */
+
+/*
+ * Map a framebuffer like drm_gem_fb_vmap(). The cache keeps a mapping of
+ * its own for the framebuffers used last, so mapping one of those again
+ * only takes a reference, and so does an imported dma-buf's vmap at the
+ * exporter.
+ */
+static int beada_fb_vmap(struct beada_device *beada, struct drm_framebuffer *fb,
+			 struct dma_buf_map *map, struct dma_buf_map *data)
+{
+	struct dma_buf_map old_map[DRM_FORMAT_MAX_PLANES];
+	struct drm_framebuffer *old_fb;
+	struct beada_map *entry;
+	ktime_t start = ktime_get();
 	int ret;
-	unsigned int len, len1;
-	int width, height, margin, width_mm, height_mm;
-	char *model;
 
-	len = CMD_SIZE;
+	mutex_lock(&beada->map_lock);
+
+	list_for_each_entry(entry, &beada->map_lru, lru) {
+		if (entry->fb == fb) {
+			list_move(&entry->lru, &beada->map_lru);
+			beada->stats.map_hits++;
+			goto out_map;
+		}
+	}
+
+	beada->stats.map_misses++;
+	ret = drm_gem_fb_vmap(fb, map, data);
+	if (ret || !READ_ONCE(map_cache))
+		goto out_unlock;
+
+	/* the mapping just made goes to the least recently used entry */
+	entry = list_last_entry(&beada->map_lru, struct beada_map, lru);
+	old_fb = entry->fb;
+	memcpy(old_map, entry->map, sizeof(old_map));
+	memcpy(entry->map, map, sizeof(entry->map));
+	drm_framebuffer_get(fb);
+	entry->fb = fb;
+	list_move(&entry->lru, &beada->map_lru);
+
+	if (old_fb) {
+		drm_gem_fb_vunmap(old_fb, old_map);
+		drm_framebuffer_put(old_fb);
+	}
+
+out_map:
+	/* the cached mapping stays, this only adds a user */
+	ret = drm_gem_fb_vmap(fb, map, data);
+out_unlock:
+	mutex_unlock(&beada->map_lock);
+	beada_hist_add(&beada->stats.map_us, start);
+
+	return ret;
+}
+
+/* unmap everything the cache holds, the planes no longer show it */
+static void beada_map_cache_release(struct beada_device *beada)
+{
+	struct beada_map *entry;
+
+	mutex_lock(&beada->map_lock);
+	list_for_each_entry(entry, &beada->map_lru, lru) {
+		if (!entry->fb)
+			continue;
+		drm_gem_fb_vunmap(entry->fb, entry->map);
+		drm_framebuffer_put(entry->fb);
+		entry->fb = NULL;
+	}
+	mutex_unlock(&beada->map_lock);
+}
+
+static void beada_map_cache_init(struct beada_device *beada)
+{
+	int i;
+
+	mutex_init(&beada->map_lock);
+	INIT_LIST_HEAD(&beada->map_lru);
+	for (i = 0; i < BEADA_MAP_CACHE; i++)
+		list_add_tail(&beada->maps[i].lru, &beada->map_lru);
+}
+
+static void beada_layer_put(struct beada_layer *layer)
+{
+	if (!layer->fb)
+		return;
+
+	drm_gem_fb_vunmap(layer->fb, layer->map);
+	drm_framebuffer_put(layer->fb);
+	layer->fb = NULL;
+}
+
+/* make @dst show what @src does, with its own framebuffer reference */
+static int beada_layer_copy(struct beada_device *beada, struct beada_layer *dst,
+			    const struct beada_layer *src)
+{
+	int ret;
+
+	if (dst->fb != src->fb) {
+		beada_layer_put(dst);
+		if (src->fb) {
+			ret = beada_fb_vmap(beada, src->fb, dst->map, dst->data);
+			if (ret)
+				return ret;
+			drm_framebuffer_get(src->fb);
+			dst->fb = src->fb;
+		}
+	}
+
+	dst->rect = src->rect;
+	dst->src_x = src->src_x;
+	dst->src_y = src->src_y;
+
+	return 0;
+}
+
+/* premultiplied ARGB8888 over RGB565 */
+static u16 beada_blend_pixel(u16 dst, u32 src)
+{
+	unsigned int a = 255 - (src >> 24);
+	unsigned int r = (dst >> 11) << 3, g = ((dst >> 5) & 0x3f) << 2, b = (dst & 0x1f) << 3;
+
+	r = min(((src >> 16) & 0xff) + (r | r >> 5) * a / 255, 255U);
+	g = min(((src >> 8) & 0xff) + (g | g >> 6) * a / 255, 255U);
+	b = min((src & 0xff) + (b | b >> 5) * a / 255, 255U);
+
+	return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+}
+
+/* blend the part of a layer inside @clip into its converted pixels at @dst */
+static void beada_layer_blend(const struct beada_layer *layer, void *dst,
+			      const struct drm_rect *clip)
+{
+	const struct drm_framebuffer *fb = layer->fb;
+	unsigned int pitch = drm_rect_width(clip);
+	struct drm_rect rect = layer->rect;
+	const u8 *src;
+	u16 *out;
+	u32 pix;
+	int x, y;
+
+	if (!fb || !drm_rect_intersect(&rect, clip))
+		return;
+
+	for (y = rect.y1; y < rect.y2; y++) {
+		src = layer->data[0].vaddr +
+		      (layer->src_y + y - layer->rect.y1) * fb->pitches[0] +
+		      (layer->src_x + rect.x1 - layer->rect.x1) * fb->format->cpp[0];
+		out = (u16 *)dst + (y - clip->y1) * pitch + rect.x1 - clip->x1;
+
+		if (fb->format->format == DRM_FORMAT_RGB565) {
+			memcpy(out, src, drm_rect_width(&rect) * sizeof(u16));
+			continue;
+		}
+
+		for (x = rect.x1; x < rect.x2; x++, src += sizeof(u32), out++) {
+			pix = *(const u32 *)src;
+			if (!fb->format->has_alpha)
+				pix |= 0xff000000;
+			if (pix)
+				*out = beada_blend_pixel(*out, pix);
+		}
+	}
+}
+
+static void beada_layers_blend(struct beada_device *beada, void *dst, const struct drm_rect *clip)
+{
+	struct beada_layer *layer;
+	unsigned int i;
+
+	for (i = 0; i < BEADA_LAYERS; i++) {
+		layer = &beada->layers[i];
+		if (!layer->fb || drm_gem_fb_begin_cpu_access(layer->fb, DMA_FROM_DEVICE))
+			continue;
+		beada_layer_blend(layer, dst, clip);
+		drm_gem_fb_end_cpu_access(layer->fb, DMA_FROM_DEVICE);
+	}
+}
+
+static bool beada_layers_cover(struct beada_device *beada, const struct drm_rect *clip)
+{
+	struct drm_rect rect;
+	unsigned int i;
+
+	for (i = 0; i < BEADA_LAYERS; i++) {
+		rect = beada->layers[i].rect;
+		if (beada->layers[i].fb && drm_rect_intersect(&rect, clip))
+			return true;
+	}
+
+	return false;
+}
+
+static int beada_buf_copy(struct beada_device *beada, void *dst, const struct dma_buf_map *map,
+			  struct drm_framebuffer *fb, struct drm_rect *clip)
+{
+	unsigned int i, n;
+	ktime_t start;
+	int ret;
+
+	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
+	if (ret)
+		return ret;
+
+	trace_beada_convert_start(beada->dev.dev, clip, beada_rect_bytes(clip));
+	start = ktime_get();
+
+	n = beada_stripes_count(clip);
+	beada_stripes_start(beada, dst, map, fb, clip, n, true);
+	for (i = 0; i < n; i++)
+		beada_stripe_wait(beada, i);
+	beada_layers_blend(beada, dst, clip);
+
+	trace_beada_convert_end(beada->dev.dev, clip, beada_rect_bytes(clip));
+	beada_hist_add(&beada->stats.convert_us, start);
+
+	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+
+	return 0;
+}
+
+static void beada_rect_union(struct drm_rect *dst, const struct drm_rect *src)
+{
+	dst->x1 = min(dst->x1, src->x1);
+	dst->y1 = min(dst->y1, src->y1);
+	dst->x2 = max(dst->x2, src->x2);
+	dst->y2 = max(dst->y2, src->y2);
+}
+
+static void beada_damage_bbox(const struct beada_damage *damage, struct drm_rect *bbox)
+{
+	unsigned int i;
+
+	*bbox = damage->clips[0];
+	for (i = 1; i < damage->num_clips; i++)
+		beada_rect_union(bbox, &damage->clips[i]);
+}
+
+/* add a clip, falling back to the bounding box once all slots are used */
+static void beada_damage_add(struct beada_damage *damage, const struct drm_rect *clip)
+{
+	struct drm_rect *c;
+	unsigned int i;
+
+	for (i = 0; i < damage->num_clips; i++) {
+		c = &damage->clips[i];
+		if (clip->x1 >= c->x1 && clip->y1 >= c->y1 &&
+		    clip->x2 <= c->x2 && clip->y2 <= c->y2)
+			return;
+	}
+
+	if (damage->num_clips < BEADA_MAX_CLIPS) {
+		damage->clips[damage->num_clips++] = *clip;
+		return;
+	}
+
+	beada_damage_bbox(damage, &damage->clips[0]);
+	beada_rect_union(&damage->clips[0], clip);
+	damage->num_clips = 1;
+}
+
+static void beada_damage_merge(struct beada_damage *damage, const struct beada_damage *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < other->num_clips; i++)
+		beada_damage_add(damage, &other->clips[i]);
+}
+
+/* called with frame_lock held */
+static bool beada_rect_sent(struct beada_device *beada, const struct drm_rect *rect)
+{
+	return (beada->old_rect_x1 == rect->x1) &&
+		(beada->old_rect_y1 == rect->y1) &&
+		(beada->old_rect_x2 == rect->x2) &&
+		(beada->old_rect_y2 == rect->y2);
+}
+
+/* a start tag's cost in pixel bytes, called with frame_lock held */
+static size_t beada_tag_cost(struct beada_device *beada)
+{
+	unsigned int cost = READ_ONCE(tag_cost);
+
+	if (cost)
+		return cost;
+	if (!beada->link.tag_ns || !beada->link.byte_ps)
+		return BEADA_TAG_COST;
+
+	return div_u64((u64)beada->link.tag_ns * 1000, beada->link.byte_ps);
+}
+
+static void beada_link_avg(u32 *avg, u64 sample)
+{
+	sample = min_t(u64, sample, U32_MAX);
+	*avg = *avg ? *avg - *avg / 8 + (u32)sample / 8 : sample;
+}
+
+static void beada_link_fit_avg(u64 *avg, u64 sample)
+{
+	*avg = *avg ? *avg - *avg / 16 + sample / 16 : sample;
+}
+
+/*
+ * A clip right after a start tag took the panel's pause plus its pixels.
+ * Fitting its time against its length over clips of different sizes tells
+ * the two apart, so the pixel rate is learned even if every upload is
+ * tagged. Clips all of one size leave it to the untagged ones.
+ */
+static void beada_link_fit(struct beada_link *link, u32 len, u64 ns)
+{
+	u64 len_sq, len_ns;
+
+	ns = min_t(u64, ns, U32_MAX);
+	beada_link_fit_avg(&link->fit_len, len);
+	beada_link_fit_avg(&link->fit_ns, ns);
+	beada_link_fit_avg(&link->fit_len2, (u64)len * len);
+	beada_link_fit_avg(&link->fit_len_ns, len * ns);
+
+	len_sq = link->fit_len * link->fit_len;
+	len_ns = link->fit_len * link->fit_ns;
+	if (link->fit_len2 <= len_sq || link->fit_len_ns <= len_ns)
+		return;
+
+	/* sizes too alike, the variance is all rounding and jitter */
+	if ((link->fit_len2 - len_sq) * 16 < len_sq)
+		return;
+
+	beada_link_avg(&link->byte_ps, mul_u64_u64_div_u64(link->fit_len_ns - len_ns, 1000,
+							   link->fit_len2 - len_sq));
+}
+
+static bool beada_frame_tag_urb(const struct beada_frame *frame, const struct urb *urb)
+{
+	unsigned int i;
+
+	for (i = 0; i < frame->damage.num_clips; i++)
+		if (urb == frame->tag_urbs[i])
+			return true;
+
+	return false;
+}
+
+/*
+ * Bulk URBs on the endpoint complete back to back, so the time since the
+ * previous completion is what a transfer cost. A clip right after a start
+ * tag only has its pixels counted, anything beyond goes to the tag, and
+ * feeds the fit of the two. Called with frame_lock held.
+ */
+static void beada_link_sample(struct beada_device *beada, struct beada_frame *frame,
+			      struct urb *urb)
+{
+	struct beada_link *link = &beada->link;
+	ktime_t now = ktime_get();
+	s64 ns = ktime_to_ns(ktime_sub(now, frame->last_done));
+	s64 pixels_ns;
+
+	frame->last_done = now;
+	if (frame->streamed || urb->status || !urb->actual_length || ns <= 0)
+		return;
+
+	if (beada_frame_tag_urb(frame, urb)) {
+		frame->tag_ns = ns;
+		return;
+	}
+
+	/* a tag's pause can only be told apart from pixels once their rate is known */
+	if (frame->tag_ns) {
+		beada_link_fit(link, urb->actual_length, ns);
+		if (link->byte_ps) {
+			pixels_ns = div_u64((u64)urb->actual_length * link->byte_ps, 1000);
+			beada_link_avg(&link->tag_ns,
+				       frame->tag_ns + max_t(s64, ns - pixels_ns, 0));
+		}
+		frame->tag_ns = 0;
+	} else if (urb->actual_length >= PAGE_SIZE) {
+		beada_link_avg(&link->byte_ps, div_u64(ns * 1000, urb->actual_length));
+	}
+}
+
+static bool beada_rect_contains(const struct drm_rect *outer, const struct drm_rect *inner)
+{
+	return outer->x1 <= inner->x1 && outer->y1 <= inner->y1 &&
+	       outer->x2 >= inner->x2 && outer->y2 >= inner->y2;
+}
+
+/*
+ * Choose how to upload the damage. Besides one upload per clip and one of
+ * their bounding box, the box may be snapped to geometries that tend to
+ * repeat: aligned to a coarse grid, widened to full rows, the rect the
+ * panel last got a tag for if it covers the box, or the whole screen.
+ * Every rect costs its pixel bytes plus a start tag unless the panel
+ * already has its geometry; the cheapest choice wins, so tags get rare
+ * when they are expensive on the link and small rects stay small when
+ * they are not.
+ */
+static void beada_damage_plan(struct beada_device *beada,
+			      const struct beada_damage *damage,
+			      struct beada_damage *plan)
+{
+	size_t frame_bytes = beada->height * beada->width * RGB565_BPP / 8;
+	size_t bytes = 0, tags = 0, best, cost, tag;
+	struct drm_rect bbox, last, prev, screen, cand[5];
+	unsigned int i, n = 0, choice = ARRAY_SIZE(cand);
+	unsigned long flags;
+
+	*plan = *damage;
+	if (!damage->num_clips)
+		return;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	last.x1 = beada->old_rect_x1;
+	last.y1 = beada->old_rect_y1;
+	last.x2 = beada->old_rect_x2;
+	last.y2 = beada->old_rect_y2;
+	tag = beada_tag_cost(beada);
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	prev = last;
+	for (i = 0; i < damage->num_clips; i++) {
+		bytes += beada_rect_bytes(&damage->clips[i]);
+		if (!drm_rect_equals(&damage->clips[i], &prev))
+			tags += tag;
+		prev = damage->clips[i];
+	}
+
+	/* overlapping clips may not fit the frame buffer when sent one by one */
+	best = bytes <= frame_bytes ? bytes + tags : SIZE_MAX;
+
+	beada_damage_bbox(damage, &bbox);
+	drm_rect_init(&screen, 0, 0, beada->width, beada->height);
+
+	cand[n++] = bbox;
+	drm_rect_init(&cand[n], round_down(bbox.x1, BEADA_SNAP_SIZE),
+		      round_down(bbox.y1, BEADA_SNAP_SIZE),
+		      round_up(bbox.x2, BEADA_SNAP_SIZE) - round_down(bbox.x1, BEADA_SNAP_SIZE),
+		      round_up(bbox.y2, BEADA_SNAP_SIZE) - round_down(bbox.y1, BEADA_SNAP_SIZE));
+	drm_rect_intersect(&cand[n++], &screen);
+	cand[n] = cand[n - 1];
+	cand[n].x1 = 0;
+	cand[n++].x2 = beada->width;
+	if (beada_rect_contains(&last, &bbox) && beada_rect_contains(&screen, &last))
+		cand[n++] = last;
+	cand[n++] = screen;
+
+	for (i = 0; i < n; i++) {
+		cost = beada_rect_bytes(&cand[i]);
+		if (!drm_rect_equals(&cand[i], &last))
+			cost += tag;
+		if (cost < best) {
+			best = cost;
+			choice = i;
+		}
+	}
+
+	if (choice == ARRAY_SIZE(cand)) {
+		if (damage->num_clips > 1)
+			beada->stats.uploads_split++;
+		return;
+	}
+
+	plan->clips[0] = cand[choice];
+	plan->num_clips = 1;
+	if (choice)
+		beada->stats.uploads_snapped++;
+	else if (damage->num_clips > 1)
+		beada->stats.uploads_merged++;
+}
+
+/* called with frame_lock held */
+static void beada_urb_status(struct beada_device *beada, struct urb *urb)
+{
+	/* unlinked URBs are not an error, the device is going away */
+	if (urb->status && urb->status != -ENOENT &&
+	    urb->status != -ECONNRESET && urb->status != -ESHUTDOWN)
+		beada_frame_fail(beada, urb->status);
+	else if (!urb->status && urb->actual_length != urb->transfer_buffer_length)
+		beada_frame_fail(beada, -EIO);
+
+	beada->stats.bytes_sent += urb->actual_length;
+}
+
+/* called with frame_lock held */
+static int beada_urb_submit(struct beada_device *beada, struct beada_frame *frame,
+			    struct urb *urb)
+{
+	int ret;
+
+	usb_anchor_urb(urb, &beada->anchor);
+	ret = usb_submit_urb(urb, GFP_ATOMIC);
+	if (ret) {
+		usb_unanchor_urb(urb);
+		return ret;
+	}
+
+	trace_beada_urb_submit(beada->dev.dev, frame->seq, urb);
+
+	frame->urbs_pending++;
+	return 0;
+}
+
+/* send a new tag if rect size changed, called with frame_lock held */
+static int beada_tag_submit(struct beada_device *beada, struct beada_frame *frame,
+			    unsigned int i)
+{
+	struct drm_rect *rect = &frame->damage.clips[i];
+	int ret;
+
+	if (beada_rect_sent(beada, rect))
+		return 0;
+
+	ret = beada_urb_submit(beada, frame, frame->tag_urbs[i]);
+	if (ret)
+		return ret;
+
+	beada_proto_trace(beada, "PanelLink start", true, frame->tag_urbs[i]->transfer_buffer,
+			  frame->tag_urbs[i]->transfer_buffer_length);
+	trace_beada_tag_send(beada->dev.dev, frame->seq, rect,
+			     frame->tag_urbs[i]->transfer_buffer_length);
+	beada->stats.tags_sent++;
+
+	beada->old_rect_x1 = rect->x1;
+	beada->old_rect_y1 = rect->y1;
+	beada->old_rect_x2 = rect->x2;
+	beada->old_rect_y2 = rect->y2;
+
+	return 0;
+}
+
+/*
+ * Hand a frame to the host controller. Bulk URBs on one endpoint complete
+ * in submission order, so each start tag lands right ahead of its clip.
+ * Called with frame_lock held, possibly from URB completion context.
+ */
+static void beada_frame_submit(struct beada_device *beada, struct beada_frame *frame)
+{
+	struct drm_rect *rect;
+	struct urb *urb;
+	unsigned int i, offset = 0;
+	size_t len;
+	int ret = 0;
+
+	frame->urbs_pending = 0;
+
+	for (i = 0; i < frame->damage.num_clips; i++) {
+		rect = &frame->damage.clips[i];
+		len = beada_rect_bytes(rect);
+
+		ret = beada_tag_submit(beada, frame, i);
+		if (ret)
+			break;
+
+		urb = frame->urbs[i];
+		if (frame->sgt[i].orig_nents) {
+			urb->transfer_buffer = NULL;
+			urb->sg = frame->sgt[i].sgl;
+			urb->num_sgs = frame->sgt[i].orig_nents;
+		} else {
+			urb->transfer_buffer = frame->buf + offset;
+			urb->sg = NULL;
+			urb->num_sgs = 0;
+			offset += len;
+		}
+		urb->transfer_buffer_length = len;
+
+		ret = beada_urb_submit(beada, frame, urb);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		beada_frame_fail(beada, ret);
+
+	/* nothing made it to the bus, the frame is free again */
+	if (!frame->urbs_pending) {
+		beada_frame_flip(beada, frame);
+		frame->state = BEADA_FRAME_FREE;
+		beada_sched_release(&beada->sched);
+		return;
+	}
+
+	frame->state = BEADA_FRAME_BUSY;
+	frame->submitted = ktime_get();
+	frame->last_done = frame->submitted;
+	frame->tag_ns = 0;
+	frame->streamed = false;
+	frame->pixels_sent = false;
+	beada->frame_busy = frame;
+	beada->stats.frames++;
+	beada->stats.clips += i;
+}
+
+/*
+ * Account for one finished transfer of a busy frame, or with a NULL @urb
+ * for the flush worker being done streaming it.
+ */
+static void beada_frame_complete(struct beada_frame *frame, struct urb *urb)
+{
+	struct beada_device *beada = frame->beada;
+	struct beada_frame *next;
+	unsigned long flags;
+	bool done;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+
+	if (urb) {
+		trace_beada_urb_complete(beada->dev.dev, frame->seq, urb);
+		beada_urb_status(beada, urb);
+		beada_link_sample(beada, frame, urb);
+
+		if (!frame->pixels_sent && !urb->status && !beada_frame_tag_urb(frame, urb)) {
+			frame->pixels_sent = true;
+			beada_hist_add(&beada->stats.first_pixels_us, frame->committed);
+		}
+	}
+
+	done = !--frame->urbs_pending;
+	if (done) {
+		trace_beada_frame_done(beada->dev.dev, frame->seq, frame->damage.num_clips,
+				       beada_damage_bytes(&frame->damage));
+		beada_hist_add(&beada->stats.transfer_us, frame->submitted);
+		beada_hist_add(&beada->stats.latency_us, frame->committed);
+		beada_frame_flip(beada, frame);
+		frame->state = BEADA_FRAME_FREE;
+		beada->frame_busy = NULL;
+		beada_sched_release(&beada->sched);
+
+		/*
+		 * The bus is free, send the newest frame waiting in the mailbox
+		 * unless other panels are in line first.
+		 */
+		next = beada->frame_queued;
+		if (next && beada_sched_request(&beada->sched, beada_damage_bytes(&next->damage))) {
+			beada->frame_queued = NULL;
+			beada_frame_submit(beada, next);
+		}
+	}
+
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	if (done)
+		wake_up(&beada->frame_wait);
+}
+
+static void beada_urb_complete(struct urb *urb)
+{
+	beada_frame_complete(urb->context, urb);
+}
+
+/*
+ * Grab a free frame for conversion. Damage of a frame still waiting in the
+ * mailbox is merged into @damage, since the new frame is going to replace it.
+ */
+static struct beada_frame *beada_frame_get(struct beada_device *beada, struct beada_damage *damage)
+{
+	struct beada_frame *frame = NULL;
+	bool stuck = false;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+
+	if (beada->frame_queued)
+		beada_damage_merge(damage, &beada->frame_queued->damage);
+
+	/* the panel stopped draining the endpoint, reclaim the bus */
+	if (beada->frame_busy &&
+	    ktime_ms_delta(ktime_get(), beada->frame_busy->submitted) >
+	    jiffies_to_msecs(PANELLINK_MAX_DELAY)) {
+		stuck = true;
+		beada_frame_fail(beada, -ETIMEDOUT);
+	}
+
+	/* with one frame busy and one queued, the ring always has a spare */
+	for (i = 0; i < BEADA_FRAME_COUNT; i++) {
+		if (beada->frames[i].state == BEADA_FRAME_FREE) {
+			frame = &beada->frames[i];
+			frame->state = BEADA_FRAME_FILLING;
+			break;
+		}
+	}
+
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	if (stuck)
+		usb_unlink_anchored_urbs(&beada->anchor);
+
+	return frame;
+}
+
+/* publish a converted frame from the flush worker, latest frame wins the mailbox */
+static void beada_frame_queue(struct beada_device *beada, struct beada_frame *frame)
+{
+	struct beada_frame *next;
+	unsigned long flags;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+
+	if (beada->frame_queued) {
+		next = beada->frame_queued;
+		trace_beada_frame_drop(beada->dev.dev, next->seq, next->damage.num_clips,
+				       beada_damage_bytes(&next->damage));
+		next->state = BEADA_FRAME_FREE;
+		beada->frame_queued = NULL;
+		beada->stats.frames_dropped++;
+
+		/* the shadow already has the dropped frame's tiles, the panel does not */
+		beada->shadow_valid = false;
+
+		/* the new frame carries the dropped one's damage, age and flip */
+		if (ktime_before(next->committed, frame->committed))
+			frame->committed = next->committed;
+		if (!frame->event)
+			swap(frame->event, next->event);
+		beada_frame_flip(beada, next);
+	}
+
+	trace_beada_frame_queue(beada->dev.dev, frame->seq, frame->damage.num_clips,
+				beada_damage_bytes(&frame->damage));
+
+	if (!beada->frame_busy &&
+	    beada_sched_request(&beada->sched, beada_damage_bytes(&frame->damage))) {
+		beada_frame_submit(beada, frame);
+	} else {
+		frame->state = BEADA_FRAME_QUEUED;
+		beada->frame_queued = frame;
+	}
+
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+}
+
+/*
+ * The scheduler granted the turn this panel waited for. If the grant was
+ * not used by a frame submitted in the meantime, send the mailbox.
+ */
+static void beada_sched_kick(struct work_struct *work)
+{
+	struct beada_device *beada = container_of(work, struct beada_device, sched.kick);
+	struct beada_frame *next;
+	unsigned long flags;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	if (!beada->frame_busy) {
+		next = beada->frame_queued;
+		beada->frame_queued = NULL;
+		if (next)
+			beada_frame_submit(beada, next);
+		else
+			beada_sched_release(&beada->sched);
+	}
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	wake_up(&beada->frame_wait);
+}
+
+static void beada_frame_put(struct beada_device *beada, struct beada_frame *frame)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	beada_frame_flip(beada, frame);
+	frame->state = BEADA_FRAME_FREE;
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+}
+
+/*
+ * Scatter-gather URBs need host controller support, and unless the
+ * controller lifts the constraint, every sg entry but the last must be a
+ * multiple of the endpoint's max packet size.
+ */
+static bool beada_sg_usable(struct beada_device *beada, size_t offset)
+{
+	unsigned int pipe = usb_sndbulkpipe(beada->udev, beada->data_snd_ept);
+	struct usb_bus *bus = beada->udev->bus;
+
+	if (!bus->sg_tablesize)
+		return false;
+
+	return bus->no_sg_constraint ||
+	       !(offset % usb_maxpacket(beada->udev, pipe, 1));
+}
+
+/*
+ * Rows of an RGB565 framebuffer already are in the panel's wire format.
+ * If a clip spans whole rows, describe it with an sg table over the GEM
+ * shmem pages instead of copying it into the frame buffer.
+ */
+static bool beada_frame_map_pages(struct beada_device *beada, struct beada_frame *frame,
+				  unsigned int i, struct drm_framebuffer *fb)
+{
+	struct drm_rect *clip = &frame->damage.clips[i];
+	struct dma_buf_map data[DRM_FORMAT_MAX_PLANES];
+	struct drm_gem_shmem_object *shmem;
+	struct sg_table *sgt = &frame->sgt[i];
+	size_t offset, len;
+
+	if (!frame->zero_copy || fb->format->format != DRM_FORMAT_RGB565 ||
+	    fb->pitches[0] != fb->width * RGB565_BPP / 8 ||
+	    clip->x1 != 0 || clip->x2 != fb->width ||
+	    beada_layers_cover(beada, clip))
+		return false;
+
+	/* imported buffers have no shmem pages of their own */
+	shmem = to_drm_gem_shmem_obj(fb->obj[0]);
+	if (shmem->base.import_attach || !shmem->pages)
+		return false;
+
+	offset = fb->offsets[0] + clip->y1 * fb->pitches[0];
+	len = beada_rect_bytes(clip);
+	if (!beada_sg_usable(beada, offset))
+		return false;
+
+	if (sg_alloc_table_from_pages(sgt, shmem->pages + (offset >> PAGE_SHIFT),
+				      DIV_ROUND_UP(offset_in_page(offset) + len, PAGE_SIZE),
+				      offset_in_page(offset), len, GFP_KERNEL))
+		goto err_clear;
+
+	if (sgt->orig_nents > beada->udev->bus->sg_tablesize)
+		goto err_free;
+
+	/* keep the pages around until the frame is reused */
+	if (!frame->fb) {
+		if (beada_fb_vmap(beada, fb, frame->map, data))
+			goto err_free;
+		drm_framebuffer_get(fb);
+		frame->fb = fb;
+	}
+
+	beada->stats.bytes_zero_copy += len;
+	return true;
+
+err_free:
+	sg_free_table(sgt);
+err_clear:
+	memset(sgt, 0, sizeof(*sgt));
+	return false;
+}
+
+/*
+ * Describe a clip packed into a vmalloc'ed frame buffer with an sg table.
+ * Clips start page aligned, so all entries but the last are whole pages
+ * and satisfy the max packet constraint of controllers that have one.
+ */
+static int beada_frame_map_buf(struct beada_frame *frame, unsigned int i, size_t offset)
+{
+	size_t len = beada_rect_bytes(&frame->damage.clips[i]);
+	int ret;
+
+	ret = sg_alloc_table_from_pages(&frame->sgt[i], frame->pages + (offset >> PAGE_SHIFT),
+					DIV_ROUND_UP(len, PAGE_SIZE), 0, len, GFP_KERNEL);
+	if (ret) {
+		memset(&frame->sgt[i], 0, sizeof(frame->sgt[i]));
+		return ret;
+	}
+
+	/* the controller reads through the linear map, not through buf */
+	flush_kernel_vmap_range(frame->buf + offset, len);
+
+	return 0;
+}
+
+/* drop the sg tables and framebuffer a finished frame was sent from */
+static void beada_frame_unmap_pages(struct beada_frame *frame)
+{
+	unsigned int i;
+
+	for (i = 0; i < BEADA_MAX_CLIPS; i++) {
+		if (!frame->sgt[i].orig_nents)
+			continue;
+		sg_free_table(&frame->sgt[i]);
+		memset(&frame->sgt[i], 0, sizeof(frame->sgt[i]));
+	}
+
+	for (i = 0; i < frame->num_chunks; i++) {
+		if (!frame->chunk_sgt[i].orig_nents)
+			continue;
+		sg_free_table(&frame->chunk_sgt[i]);
+		memset(&frame->chunk_sgt[i], 0, sizeof(frame->chunk_sgt[i]));
+	}
+	frame->num_chunks = 0;
+
+	if (frame->fb) {
+		drm_gem_fb_vunmap(frame->fb, frame->map);
+		drm_framebuffer_put(frame->fb);
+		frame->fb = NULL;
+	}
+}
+
+/* fetch and clear the status of transfers completed since the last flush */
+static int beada_frame_status(struct beada_device *beada)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	ret = beada->frame_error;
+	beada->frame_error = 0;
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	return ret;
+}
+
+static bool beada_frames_idle(struct beada_device *beada)
+{
+	unsigned long flags;
+	bool idle;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	idle = !beada->frame_busy && !beada->frame_queued;
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	return idle;
+}
+
+/* let the queued frames reach the panel, then cancel whatever is stuck */
+static void beada_frames_drain(struct beada_device *beada)
+{
+	unsigned long flags;
+	int i;
+
+	if (!wait_event_timeout(beada->frame_wait, beada_frames_idle(beada),
+				PANELLINK_MAX_DELAY)) {
+		spin_lock_irqsave(&beada->frame_lock, flags);
+		if (beada->frame_queued) {
+			beada_frame_flip(beada, beada->frame_queued);
+			beada->frame_queued->state = BEADA_FRAME_FREE;
+			beada->frame_queued = NULL;
+		}
+		spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+		usb_kill_anchored_urbs(&beada->anchor);
+	}
+
+	/* all frames are idle now, let go of the framebuffers they used */
+	for (i = 0; i < BEADA_FRAME_COUNT; i++)
+		beada_frame_unmap_pages(&beada->frames[i]);
+}
+
+static void beada_frames_free(struct beada_device *beada)
+{
+	struct beada_frame *frame;
+	int i, j;
+
+	for (i = 0; i < BEADA_FRAME_COUNT; i++) {
+		frame = &beada->frames[i];
+		beada_frame_unmap_pages(frame);
+		for (j = 0; j < BEADA_MAX_CLIPS; j++) {
+			usb_free_urb(frame->urbs[j]);
+			usb_free_urb(frame->tag_urbs[j]);
+		}
+		for (j = 0; j < BEADA_MAX_CHUNKS; j++)
+			usb_free_urb(frame->chunk_urbs[j]);
+		kfree(frame->pages);
+		kvfree(frame->buf);
+	}
+}
+
+static void beada_frames_release(struct drm_device *dev, void *res)
+{
+	struct beada_device *beada = to_beada(dev);
+
+	usb_kill_anchored_urbs(&beada->anchor);
+	beada_sched_unregister(&beada->sched);
+	/* a grant may have raced with the kill above */
+	usb_kill_anchored_urbs(&beada->anchor);
+	beada_frames_free(beada);
+}
+
+/* back a frame buffer with order-0 pages and remember them for sg tables */
+static int beada_frame_alloc_pages(struct beada_frame *frame, size_t size)
+{
+	unsigned int i, num_pages = size >> PAGE_SHIFT;
+
+	frame->buf = vmalloc(size);
+	frame->pages = kmalloc_array(num_pages, sizeof(*frame->pages), GFP_KERNEL);
+	if (!frame->buf || !frame->pages)
+		return -ENOMEM;
+
+	for (i = 0; i < num_pages; i++)
+		frame->pages[i] = vmalloc_to_page(frame->buf + i * PAGE_SIZE);
+
+	return 0;
+}
+
+static int beada_frames_init(struct beada_device *beada)
+{
+	size_t size = beada->height * beada->width * RGB565_BPP / 8 + beada->margin;
+	unsigned int pipe = usb_sndbulkpipe(beada->udev, beada->data_snd_ept);
+	struct usb_bus *bus = beada->udev->bus;
+	struct beada_frame *frame;
+	size_t sg_size;
+	bool use_sg;
+	int i, j;
+
+	init_usb_anchor(&beada->anchor);
+	spin_lock_init(&beada->frame_lock);
+	init_waitqueue_head(&beada->frame_wait);
+	beada_tag_cache_init(beada);
+	beada->stats.since = ktime_get();
+
+	/*
+	 * A full frame is over a megabyte on the larger panels. Avoid asking
+	 * for that much physically contiguous memory when the host controller
+	 * can gather pages, leaving room to start every clip on a new page.
+	 */
+	sg_size = PAGE_ALIGN(size) + BEADA_MAX_CLIPS * PAGE_SIZE;
+	use_sg = bus->sg_tablesize >= sg_size >> PAGE_SHIFT;
+
+	for (i = 0; i < BEADA_FRAME_COUNT; i++) {
+		frame = &beada->frames[i];
+		frame->beada = beada;
+
+		if (use_sg) {
+			if (beada_frame_alloc_pages(frame, sg_size))
+				goto err_free_urbs;
+		} else {
+			frame->buf = kmalloc(size, GFP_KERNEL);
+			if (!frame->buf)
+				goto err_free_urbs;
+		}
+
+		frame->tag_buf = drmm_kmalloc(&beada->dev, BEADA_MAX_CLIPS * BEADA_TAG_SIZE,
+					      GFP_KERNEL);
+		if (!frame->tag_buf)
+			goto err_free_urbs;
+
+		for (j = 0; j < BEADA_MAX_CLIPS; j++) {
+			frame->urbs[j] = usb_alloc_urb(0, GFP_KERNEL);
+			frame->tag_urbs[j] = usb_alloc_urb(0, GFP_KERNEL);
+			if (!frame->urbs[j] || !frame->tag_urbs[j])
+				goto err_free_urbs;
+
+			usb_fill_bulk_urb(frame->urbs[j], beada->udev, pipe,
+					  NULL, 0, beada_urb_complete, frame);
+			usb_fill_bulk_urb(frame->tag_urbs[j], beada->udev, pipe,
+					  frame->tag_buf + j * BEADA_TAG_SIZE,
+					  BEADA_TAG_SIZE, beada_urb_complete, frame);
+		}
+
+		for (j = 0; j < BEADA_MAX_CHUNKS; j++) {
+			frame->chunk_urbs[j] = usb_alloc_urb(0, GFP_KERNEL);
+			if (!frame->chunk_urbs[j])
+				goto err_free_urbs;
+			usb_fill_bulk_urb(frame->chunk_urbs[j], beada->udev, pipe,
+					  NULL, 0, beada_urb_complete, frame);
+		}
+	}
+
+	INIT_WORK(&beada->sched.kick, beada_sched_kick);
+	beada->sched.name = dev_name(&beada->udev->dev);
+	beada->sched.weight = 1;
+	if (beada_sched_register(&beada->sched, beada->udev))
+		goto err_free_urbs;
+
+	return drmm_add_action_or_reset(&beada->dev, beada_frames_release, NULL);
+
+err_free_urbs:
+	beada_frames_free(beada);
+	return -ENOMEM;
+}
+
+/* add a run of changed tiles, extending a rect ending right above it */
+static void beada_shadow_add_run(struct beada_damage *changed, const struct drm_rect *run)
+{
+	struct drm_rect *c;
+	unsigned int i;
+
+	for (i = 0; i < changed->num_clips; i++) {
+		c = &changed->clips[i];
+		if (c->x1 == run->x1 && c->x2 == run->x2 && c->y2 == run->y1) {
+			c->y2 = run->y2;
+			return;
+		}
+	}
+
+	beada_damage_add(changed, run);
+}
+
+/*
+ * Compare a clip converted into conv_buf against the shadow copy of the
+ * panel, tile by tile on a grid aligned to the screen, and copy changed
+ * tiles into the shadow. Runs of changed tiles within a tile row become
+ * one rect, which grows downwards while the rows below change alike.
+ */
+static void beada_shadow_diff(struct beada_device *beada, const struct drm_rect *clip,
+			      struct beada_damage *changed)
+{
+	unsigned int src_pitch = drm_rect_width(clip) * RGB565_BPP / 8;
+	unsigned int pitch = beada->width * RGB565_BPP / 8;
+	bool hash_on = READ_ONCE(band_hash);
+	int tx, ty, x1, x2, y1, y2, y;
+	struct drm_rect run, rect;
+	struct beada_band *band;
+	bool dirty, in_run, changed_band, hashed;
+	unsigned int len;
+	const u8 *src;
+	u64 hash = 0;
+	u8 *dst;
+
+	for (ty = round_down(clip->y1, BEADA_TILE_SIZE); ty < clip->y2; ty += BEADA_TILE_SIZE) {
+		y1 = max(ty, clip->y1);
+		y2 = min(ty + BEADA_TILE_SIZE, clip->y2);
+		in_run = false;
+		changed_band = false;
+
+		/* the band's rows are contiguous in conv_buf, hash them in one go */
+		band = &beada->bands[ty / BEADA_TILE_SIZE];
+		drm_rect_init(&rect, clip->x1, y1, drm_rect_width(clip), y2 - y1);
+		hashed = hash_on && !band->skip;
+		if (hash_on && band->skip)
+			band->skip--;
+		if (hashed) {
+			hash = xxh64(beada->conv_buf + (y1 - clip->y1) * src_pitch,
+				     (y2 - y1) * src_pitch, 0);
+			if (drm_rect_equals(&band->rect, &rect) && band->hash == hash) {
+				beada->stats.bytes_hashed += beada_rect_bytes(&rect);
+				continue;
+			}
+		}
+
+		for (tx = round_down(clip->x1, BEADA_TILE_SIZE); tx < clip->x2; tx += BEADA_TILE_SIZE) {
+			x1 = max(tx, clip->x1);
+			x2 = min(tx + BEADA_TILE_SIZE, clip->x2);
+			len = (x2 - x1) * RGB565_BPP / 8;
+			dirty = false;
+
+			for (y = y1; y < y2; y++) {
+				src = beada->conv_buf + (y - clip->y1) * src_pitch +
+				      (x1 - clip->x1) * RGB565_BPP / 8;
+				dst = beada->shadow + y * pitch + x1 * RGB565_BPP / 8;
+				if (!dirty && !memcmp(dst, src, len))
+					continue;
+				memcpy(dst, src, len);
+				dirty = true;
+			}
+
+			if (dirty) {
+				changed_band = true;
+				if (!in_run)
+					drm_rect_init(&run, x1, y1, x2 - x1, y2 - y1);
+				run.x2 = x2;
+				in_run = true;
+			} else if (in_run) {
+				beada_shadow_add_run(changed, &run);
+				in_run = false;
+			}
+		}
+
+		if (in_run)
+			beada_shadow_add_run(changed, &run);
+
+		/* this rect now holds the latest write to the band, or nothing is known */
+		if (hashed) {
+			band->rect = rect;
+			band->hash = hash;
+			band->skip = changed_band ? BEADA_BAND_BACKOFF : 0;
+		} else {
+			drm_rect_init(&band->rect, 0, 0, 0, 0);
+		}
+	}
+}
+
+/*
+ * Convert the damage into the shadow and replace it with the rects that
+ * actually changed. Without a valid shadow the whole screen is resent.
+ */
+static int beada_shadow_update(struct beada_device *beada, struct drm_framebuffer *fb,
+			       const struct dma_buf_map *map, struct beada_damage *damage)
+{
+	struct beada_damage changed = { .num_clips = 0 };
+	size_t bytes = 0, sent;
+	struct drm_rect *clip;
+	unsigned int i;
+	int ret;
+
+	if (!beada->shadow_valid) {
+		drm_rect_init(&changed.clips[0], 0, 0, fb->width, fb->height);
+		changed.num_clips = 1;
+
+		ret = beada_buf_copy(beada, beada->shadow, map, fb, &changed.clips[0]);
+		if (ret)
+			return ret;
+
+		memset(beada->bands, 0, DIV_ROUND_UP(beada->height, BEADA_TILE_SIZE) *
+		       sizeof(*beada->bands));
+
+		beada->shadow_valid = true;
+		*damage = changed;
+		return 0;
+	}
+
+	for (i = 0; i < damage->num_clips; i++) {
+		clip = &damage->clips[i];
+
+		ret = beada_buf_copy(beada, beada->conv_buf, map, fb, clip);
+		if (ret)
+			return ret;
+
+		beada_shadow_diff(beada, clip, &changed);
+		bytes += beada_rect_bytes(clip);
+	}
+
+	sent = beada_damage_bytes(&changed);
+	if (bytes > sent)
+		beada->stats.bytes_unchanged += bytes - sent;
+
+	*damage = changed;
+
+	return 0;
+}
+
+/*
+ * Take the shadow over from a full screen frame that was converted without
+ * a diff, rather than converting the screen a second time.
+ */
+static void beada_shadow_fill(struct beada_device *beada, struct beada_frame *frame)
+{
+	struct drm_rect *clip = &frame->damage.clips[0];
+	struct drm_rect screen;
+
+	drm_rect_init(&screen, 0, 0, beada->width, beada->height);
+	if (frame->damage.num_clips != 1 || !drm_rect_equals(clip, &screen))
+		return;
+
+	memcpy(beada->shadow, frame->buf, beada_rect_bytes(clip));
+	memset(beada->bands, 0, DIV_ROUND_UP(beada->height, BEADA_TILE_SIZE) *
+	       sizeof(*beada->bands));
+	beada->shadow_valid = true;
+}
+
+/* pack a rect of the shadow into a frame buffer */
+static void beada_shadow_copy(struct beada_device *beada, u8 *dst, const struct drm_rect *rect)
+{
+	unsigned int pitch = beada->width * RGB565_BPP / 8;
+	unsigned int len = drm_rect_width(rect) * RGB565_BPP / 8;
+	const u8 *src = beada->shadow + rect->y1 * pitch + rect->x1 * RGB565_BPP / 8;
+	int y;
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		memcpy(dst, src, len);
+		src += pitch;
+		dst += len;
+	}
+}
+
+static void beada_shadow_release(struct drm_device *dev, void *res)
+{
+	struct beada_device *beada = to_beada(dev);
+
+	kfree(beada->bands);
+	vfree(beada->conv_buf);
+	vfree(beada->shadow);
+}
+
+static int beada_shadow_init(struct beada_device *beada)
+{
+	size_t size = beada->height * beada->width * RGB565_BPP / 8;
+
+	beada->shadow = vzalloc(size);
+	beada->conv_buf = vmalloc(size);
+	beada->bands = kcalloc(DIV_ROUND_UP(beada->height, BEADA_TILE_SIZE),
+			       sizeof(*beada->bands), GFP_KERNEL);
+	if (!beada->shadow || !beada->conv_buf || !beada->bands) {
+		kfree(beada->bands);
+		vfree(beada->conv_buf);
+		vfree(beada->shadow);
+		return -ENOMEM;
+	}
+
+	return drmm_add_action_or_reset(&beada->dev, beada_shadow_release, NULL);
+}
+
+static bool beada_frame_mailbox_empty(struct beada_device *beada)
+{
+	unsigned long flags;
+	bool empty;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	empty = !beada->frame_queued;
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	return empty;
+}
+
+/*
+ * Put a frame on the bus before its pixels are converted, if the bus is
+ * idle. The flush worker holds an extra pending count until it has sent
+ * the last chunk, so the frame cannot complete underneath it.
+ */
+static bool beada_frame_stream_begin(struct beada_device *beada, struct beada_frame *frame)
+{
+	unsigned long flags;
+	bool idle;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+
+	idle = !beada->frame_busy && !beada->frame_queued &&
+	       beada_sched_request(&beada->sched, beada_damage_bytes(&frame->damage));
+	if (idle) {
+		trace_beada_frame_queue(beada->dev.dev, frame->seq, frame->damage.num_clips,
+					beada_damage_bytes(&frame->damage));
+		frame->state = BEADA_FRAME_BUSY;
+		frame->urbs_pending = 1;
+		frame->submitted = ktime_get();
+		frame->streamed = true;
+		frame->pixels_sent = false;
+		beada->frame_busy = frame;
+		beada->stats.frames++;
+		beada->stats.frames_streamed++;
+		beada->stats.clips += frame->damage.num_clips;
+	}
+
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	return idle;
+}
+
+/*
+ * Send @len bytes of a streamed clip at @offset in the frame buffer through
+ * one of the frame's URBs, described by @sgt on hosts that gather pages.
+ */
+static int beada_chunk_submit(struct beada_device *beada, struct beada_frame *frame,
+			      struct urb *urb, struct sg_table *sgt, size_t offset, size_t len)
+{
+	unsigned long flags;
+	int ret;
+
+	if (frame->pages) {
+		ret = sg_alloc_table_from_pages(sgt, frame->pages + (offset >> PAGE_SHIFT),
+						DIV_ROUND_UP(len, PAGE_SIZE), 0, len, GFP_KERNEL);
+		if (ret) {
+			memset(sgt, 0, sizeof(*sgt));
+			return ret;
+		}
+		flush_kernel_vmap_range(frame->buf + offset, len);
+
+		urb->transfer_buffer = NULL;
+		urb->sg = sgt->sgl;
+		urb->num_sgs = sgt->orig_nents;
+	} else {
+		urb->transfer_buffer = frame->buf + offset;
+		urb->sg = NULL;
+		urb->num_sgs = 0;
+	}
+	urb->transfer_buffer_length = len;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	ret = beada_urb_submit(beada, frame, urb);
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	return ret;
+}
+
+/*
+ * Convert a clip in stripes of at least stream_rows rows and send each one
+ * as soon as it is ready, in order, so the panel receives the top of the
+ * clip while the rest is still being converted. Unless stripe_rows keeps
+ * conversion on one CPU, the stripes convert in parallel meanwhile. Chunks
+ * other than the last are cut at page boundaries, which keeps short
+ * packets out of the middle of the clip.
+ */
+static int beada_clip_stream(struct beada_device *beada, struct beada_frame *frame,
+			     unsigned int i, size_t offset, struct drm_framebuffer *fb,
+			     const struct dma_buf_map *data)
+{
+	struct drm_rect *clip = &frame->damage.clips[i];
+	unsigned int rows = max(READ_ONCE(stream_rows), 1U);
+	size_t pitch = drm_rect_width(clip) * RGB565_BPP / 8;
+	size_t len = beada_rect_bytes(clip);
+	struct beada_stripe *stripe;
+	size_t sent = 0, end;
+	unsigned int j, k, n;
+	ktime_t start;
+	int ret;
+
+	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
+	if (ret)
+		return ret;
+
+	trace_beada_convert_start(beada->dev.dev, clip, len);
+	start = ktime_get();
+
+	n = clamp_t(unsigned int, DIV_ROUND_UP(drm_rect_height(clip), rows), 1, BEADA_MAX_STRIPES);
+	beada_stripes_start(beada, frame->buf + offset, data, fb, clip, n,
+			    READ_ONCE(stripe_rows));
+
+	for (j = 0; j < n; j++) {
+		stripe = beada_stripe_wait(beada, j);
+		beada_layers_blend(beada, stripe->dst, &stripe->clip);
+
+		end = (stripe->clip.y2 - clip->y1) * pitch;
+		if (end == len) {
+			/* the clip's own URB sends the rest */
+			ret = beada_chunk_submit(beada, frame, frame->urbs[i], &frame->sgt[i],
+						 offset + sent, end - sent);
+			break;
+		}
+
+		/* with the pool used up, the rest goes out in one piece */
+		end = round_down(end, PAGE_SIZE);
+		if (end <= sent || frame->num_chunks == BEADA_MAX_CHUNKS)
+			continue;
+
+		k = frame->num_chunks++;
+		ret = beada_chunk_submit(beada, frame, frame->chunk_urbs[k], &frame->chunk_sgt[k],
+					 offset + sent, end - sent);
+		if (ret)
+			break;
+		sent = end;
+	}
+
+	/* stripes still converting write into the frame, let them finish */
+	while (beada->stripes_queued && ++j < n)
+		flush_work(&beada->stripes[j].work);
+
+	trace_beada_convert_end(beada->dev.dev, clip, len);
+	beada_hist_add(&beada->stats.convert_us, start);
+
+	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+
+	return ret;
+}
+
+/* send a frame started with beada_frame_stream_begin() clip by clip */
+static int beada_frame_stream(struct beada_device *beada, struct beada_frame *frame,
+			      struct drm_framebuffer *fb, const struct dma_buf_map *data)
+{
+	unsigned int i, offset = 0;
+	unsigned long flags;
+	struct urb *urb;
+	int ret = 0;
+
+	for (i = 0; i < frame->damage.num_clips; i++) {
+		ret = beada_frame_tag(beada, frame, i);
+		if (ret)
+			break;
+
+		spin_lock_irqsave(&beada->frame_lock, flags);
+		ret = beada_tag_submit(beada, frame, i);
+		spin_unlock_irqrestore(&beada->frame_lock, flags);
+		if (ret)
+			break;
+
+		/* nothing to convert, the clip goes out in one piece */
+		if (beada_frame_map_pages(beada, frame, i, fb)) {
+			urb = frame->urbs[i];
+			urb->transfer_buffer = NULL;
+			urb->sg = frame->sgt[i].sgl;
+			urb->num_sgs = frame->sgt[i].orig_nents;
+			urb->transfer_buffer_length = beada_rect_bytes(&frame->damage.clips[i]);
+
+			spin_lock_irqsave(&beada->frame_lock, flags);
+			ret = beada_urb_submit(beada, frame, urb);
+			spin_unlock_irqrestore(&beada->frame_lock, flags);
+			if (ret)
+				break;
+			continue;
+		}
+
+		if (frame->pages)
+			offset = PAGE_ALIGN(offset);
+
+		ret = beada_clip_stream(beada, frame, i, offset, fb, data);
+		if (ret)
+			break;
+
+		offset += beada_rect_bytes(&frame->damage.clips[i]);
+	}
+
+	if (ret) {
+		/* the panel got part of a clip, make the next one start with a tag */
+		spin_lock_irqsave(&beada->frame_lock, flags);
+		beada_frame_fail(beada, ret);
+		beada->old_rect_x1 = 0;
+		beada->old_rect_y1 = 0;
+		beada->old_rect_x2 = 0;
+		beada->old_rect_y2 = 0;
+		spin_unlock_irqrestore(&beada->frame_lock, flags);
+	}
+
+	beada_frame_complete(frame, NULL);
+
+	return ret;
+}
+
+/*
+ * Put the pixels of clip @i where the frame's URB can send them from,
+ * advancing @offset past whatever was packed into the frame buffer.
+ */
+static int beada_frame_pack(struct beada_device *beada, struct beada_frame *frame,
+			    unsigned int i, unsigned int *offset, struct drm_framebuffer *fb,
+			    const struct dma_buf_map *data, bool diff)
+{
+	struct drm_rect *clip = &frame->damage.clips[i];
+	int ret = 0;
+
+	if (beada_frame_map_pages(beada, frame, i, fb))
+		return 0;
+
+	if (frame->pages)
+		*offset = PAGE_ALIGN(*offset);
+
+	if (diff)
+		beada_shadow_copy(beada, frame->buf + *offset, clip);
+	else
+		ret = beada_buf_copy(beada, frame->buf + *offset, data, fb, clip);
+	if (!ret && frame->pages)
+		ret = beada_frame_map_buf(frame, i, *offset);
+	if (ret)
+		return ret;
+
+	*offset += beada_rect_bytes(clip);
+	return 0;
+}
+
+static void beada_fb_update_work(struct work_struct *work)
+{
+	struct beada_device *beada = container_of(work, struct beada_device, fb_update.work.work);
+	struct dma_buf_map map[DRM_FORMAT_MAX_PLANES];
+	struct dma_buf_map data[DRM_FORMAT_MAX_PLANES];
+	struct drm_pending_vblank_event *event;
+	struct drm_framebuffer *fb;
+	struct beada_frame *frame;
+	struct beada_damage damage;
+	unsigned int i, offset = 0;
+	ktime_t committed;
+	bool diff, fill, resync, stream;
+	int idx, ret;
+
+	/*
+	 * While a converted frame still waits for the bus there is no point
+	 * in converting another one; let further commits pile up meanwhile.
+	 */
+	wait_event_timeout(beada->frame_wait, beada_frame_mailbox_empty(beada),
+			   PANELLINK_MAX_DELAY);
+
+	mutex_lock(&beada->fb_update.lock);
+	if (beada->fb_update.open) {
+		/* its atomic_flush queues the worker again */
+		mutex_unlock(&beada->fb_update.lock);
+		return;
+	}
+	fb = beada->fb_update.fb;
+	damage = beada->fb_update.damage;
+	memcpy(map, beada->fb_update.map, sizeof(map));
+	memcpy(data, beada->fb_update.data, sizeof(data));
+	resync = beada->fb_update.resync;
+	committed = beada->fb_update.committed;
+	event = beada->fb_update.event;
+	beada->fb_update.fb = NULL;
+	beada->fb_update.event = NULL;
+	if (beada->fb_update.layers_changed) {
+		for (i = 0; i < BEADA_LAYERS; i++)
+			if (beada_layer_copy(beada, &beada->layers[i],
+					     &beada->fb_update.layers[i]))
+				dev_err_once(beada->dev.dev, "Failed to map plane\n");
+		beada->fb_update.layers_changed = false;
+	}
+	beada->fb_update.resync = false;
+	mutex_unlock(&beada->fb_update.lock);
+
+	if (!fb)
+		return;
+
+	beada->last_flush = ktime_get();
+
+	if (!drm_dev_enter(&beada->dev, &idx))
+		goto out_fb_put;
+
+	/*
+	 * Report failures of transfers that completed since the last flush.
+	 * The panel may not show what the shadow says any more.
+	 */
+	ret = beada_frame_status(beada);
+	if (ret) {
+		dev_err_once(beada->dev.dev, "Failed to update display %d\n", ret);
+		resync = true;
+	}
+
+	diff = READ_ONCE(tile_diff);
+	if (resync || !diff)
+		beada->shadow_valid = false;
+
+	/*
+	 * A diff needs all damage converted before the first rect is known,
+	 * so only updates with nothing to diff are streamed: all of them
+	 * without tile_diff, and full screen resyncs of the shadow, which
+	 * then takes the converted frame over.
+	 */
+	stream = READ_ONCE(stream_rows);
+	fill = diff && !beada->shadow_valid && stream;
+	if (fill) {
+		drm_rect_init(&damage.clips[0], 0, 0, beada->width, beada->height);
+		damage.num_clips = 1;
+	} else if (diff) {
+		ret = beada_shadow_update(beada, fb, &data[0], &damage);
+		if (!ret && !damage.num_clips)
+			beada->stats.flushes_skipped++;
+		if (ret || !damage.num_clips)
+			goto err_msg;
+	}
+
+	frame = beada_frame_get(beada, &damage);
+	if (!frame) {
+		ret = -EBUSY;
+		goto err_msg;
+	}
+
+	frame->seq = ++beada->frame_seq;
+	frame->committed = committed;
+	frame->event = event;
+	event = NULL;
+	frame->zero_copy = !diff;
+	beada_frame_unmap_pages(frame);
+	beada_damage_plan(beada, &damage, &frame->damage);
+
+	if ((!diff || fill) && stream && beada_frame_stream_begin(beada, frame)) {
+		ret = beada_frame_stream(beada, frame, fb, &data[0]);
+		if (!ret && fill)
+			beada_shadow_fill(beada, frame);
+		goto err_msg;
+	}
+
+	for (i = 0; i < frame->damage.num_clips; i++) {
+		ret = beada_frame_pack(beada, frame, i, &offset, fb, &data[0], diff && !fill);
+		if (!ret)
+			ret = beada_frame_tag(beada, frame, i);
+		if (ret) {
+			beada_frame_put(beada, frame);
+			goto err_msg;
+		}
+	}
+
+	if (fill)
+		beada_shadow_fill(beada, frame);
+
+	/* the URBs complete asynchronously, no need to wait for the panel */
+	beada_frame_queue(beada, frame);
+
+err_msg:
+	if (ret) {
+		/* the shadow may hold tiles that never went out */
+		beada->shadow_valid = false;
+		dev_err_once(beada->dev.dev, "Failed to update display %d\n", ret);
+	}
+
+	drm_dev_exit(idx);
+out_fb_put:
+	/* nothing went out for this commit, flip right away */
+	beada_vblank_arm(beada, event);
+	drm_gem_fb_vunmap(fb, map);
+	drm_framebuffer_put(fb);
+}
+
+/* jiffies until the next flush is due under the max_fps cap */
+static unsigned long beada_fb_update_delay(struct beada_device *beada)
+{
+	unsigned int fps = READ_ONCE(beada->max_fps);
+	s64 us;
+
+	if (!fps)
+		return 0;
+
+	us = ktime_us_delta(ktime_add_us(beada->last_flush, USEC_PER_SEC / fps), ktime_get());
+
+	return us > 0 ? usecs_to_jiffies(us) : 0;
+}
+
+/*
+ * Record damage for the flush worker. This runs in the atomic commit and
+ * only takes a reference on the framebuffer and its mapping, all pixel
+ * conversion and USB I/O happens on the worker. The commit's atomic_flush
+ * hands it over, see beada_fb_update_commit().
+ */
+static void beada_fb_mark_dirty(struct drm_framebuffer *fb, const struct beada_damage *damage)
+{
+	struct beada_device *beada = to_beada(fb->dev);
+	struct dma_buf_map map[DRM_FORMAT_MAX_PLANES];
+	struct dma_buf_map data[DRM_FORMAT_MAX_PLANES];
+	struct dma_buf_map old_map[DRM_FORMAT_MAX_PLANES];
+	struct drm_framebuffer *old_fb;
+	struct drm_rect bbox;
+	int ret;
+
+	mutex_lock(&beada->fb_update.lock);
+
+	old_fb = beada->fb_update.fb;
+	if (old_fb) {
+		beada_damage_bbox(damage, &bbox);
+		trace_beada_commit_coalesced(fb->dev->dev, &bbox, beada_damage_bytes(damage));
+		beada_damage_merge(&beada->fb_update.damage, damage);
+		beada->stats.commits_coalesced++;
+	} else {
+		beada->fb_update.damage = *damage;
+		beada->fb_update.committed = ktime_get();
+	}
+
+	if (old_fb != fb) {
+		ret = beada_fb_vmap(beada, fb, map, data);
+		if (ret) {
+			mutex_unlock(&beada->fb_update.lock);
+			dev_err_once(fb->dev->dev, "Failed to map framebuffer %d\n", ret);
+			return;
+		}
+		drm_framebuffer_get(fb);
+
+		/* swap in the new framebuffer, the old one is released below */
+		memcpy(old_map, beada->fb_update.map, sizeof(old_map));
+		memcpy(beada->fb_update.map, map, sizeof(map));
+		memcpy(beada->fb_update.data, data, sizeof(data));
+		beada->fb_update.fb = fb;
+	} else {
+		old_fb = NULL;
+	}
+
+	mutex_unlock(&beada->fb_update.lock);
+
+	if (old_fb) {
+		drm_gem_fb_vunmap(old_fb, old_map);
+		drm_framebuffer_put(old_fb);
+	}
+}
+
+/* a commit starts recording damage, the worker must not take it half done */
+static void beada_fb_update_open(struct beada_device *beada)
+{
+	mutex_lock(&beada->fb_update.lock);
+	beada->fb_update.open = true;
+	mutex_unlock(&beada->fb_update.lock);
+}
+
+/*
+ * Hand the damage recorded by a commit to the flush worker, together with
+ * its page flip event. @event completes with the flush that picks up the
+ * damage, or on the next vblank if the commit left nothing to flush.
+ */
+static void beada_fb_update_commit(struct beada_device *beada,
+				   struct drm_pending_vblank_event *event)
+{
+	struct drm_pending_vblank_event *old = event;
+	bool queue;
+
+	mutex_lock(&beada->fb_update.lock);
+	beada->fb_update.open = false;
+	queue = beada->fb_update.fb;
+	if (queue && event) {
+		old = beada->fb_update.event;
+		beada->fb_update.event = event;
+	}
+	mutex_unlock(&beada->fb_update.lock);
+
+	/* an older flip still waiting is overtaken by this one */
+	beada_vblank_arm(beada, old);
+
+	if (queue)
+		queue_delayed_work(beada->wq, &beada->fb_update.work,
+				   beada_fb_update_delay(beada));
+}
+
+/* drop damage the worker has not picked up yet */
+static void beada_fb_update_cancel(struct beada_device *beada)
+{
+	struct dma_buf_map map[DRM_FORMAT_MAX_PLANES];
+	struct drm_pending_vblank_event *event;
+	struct drm_framebuffer *fb;
+
+	cancel_delayed_work_sync(&beada->fb_update.work);
+
+	mutex_lock(&beada->fb_update.lock);
+	fb = beada->fb_update.fb;
+	event = beada->fb_update.event;
+	memcpy(map, beada->fb_update.map, sizeof(map));
+	beada->fb_update.fb = NULL;
+	beada->fb_update.event = NULL;
+	mutex_unlock(&beada->fb_update.lock);
+
+	beada_vblank_arm(beada, event);
+
+	if (fb) {
+		drm_gem_fb_vunmap(fb, map);
+		drm_framebuffer_put(fb);
+	}
+}
+
+/* let go of the framebuffers the flush worker blends, it is idle */
+static void beada_layers_release(struct beada_device *beada)
+{
+	unsigned int i;
+
+	for (i = 0; i < BEADA_LAYERS; i++)
+		beada_layer_put(&beada->layers[i]);
+
+	mutex_lock(&beada->fb_update.lock);
+	beada->fb_update.layers_changed = true;
+	mutex_unlock(&beada->fb_update.lock);
+}
+
+static void beada_fb_update_release(struct drm_device *dev, void *res)
+{
+	struct beada_device *beada = to_beada(dev);
+	unsigned int i;
+
+	destroy_workqueue(beada->wq);
+
+	beada_layers_release(beada);
+	for (i = 0; i < BEADA_LAYERS; i++)
+		beada_layer_put(&beada->fb_update.layers[i]);
+	beada_map_cache_release(beada);
+}
+
+static int beada_fb_update_init(struct beada_device *beada)
+{
+	unsigned int i;
+
+	mutex_init(&beada->fb_update.lock);
+	beada_map_cache_init(beada);
+	INIT_DELAYED_WORK(&beada->fb_update.work, beada_fb_update_work);
+	beada->max_fps = READ_ONCE(max_fps);
+	for (i = 0; i < BEADA_MAX_STRIPES; i++)
+		INIT_WORK(&beada->stripes[i].work, beada_stripe_work);
+
+	/* ordered, so PanelLink traffic is never issued from two threads */
+	beada->wq = alloc_ordered_workqueue("beada-%s", WQ_HIGHPRI,
+					    dev_name(beada->dev.dev));
+	if (!beada->wq)
+		return -ENOMEM;
+
+	return drmm_add_action_or_reset(&beada->dev, beada_fb_update_release, NULL);
+}
 
-	// prepare statuslink command
-	ret = fillSLGetInfo(beada->cmd_buf, &len);
-	if (ret) {
-		DRM_DEV_ERROR(&beada->udev->dev, "fillSLGetInfo() error %d\n", ret);
-		return -EIO;
-	}
+/* ------------------------------------------------------------------ */
+/* beada vblank							      */
 
-	HexDump(beada->cmd_buf, len, beada->cmd_buf);
+static enum hrtimer_restart beada_vblank_timer(struct hrtimer *timer)
+{
+	struct beada_device *beada = container_of(timer, struct beada_device, vblank_timer);
 
-	/* send request */
-	ret = usb_bulk_msg(beada->udev,
-			usb_sndbulkpipe(beada->udev, beada->misc_snd_ept),
-			beada->cmd_buf, len, &len1, CMD_TIMEOUT);
+	if (!READ_ONCE(beada->vblank_enabled))
+		return HRTIMER_NORESTART;
 
-	if (ret || len1 != len) {
-		DRM_DEV_ERROR(&beada->udev->dev, "usb_bulk_msg() write error %d\n", ret);
-		return -EIO;
-	}
+	drm_crtc_handle_vblank(&beada->crtc);
+	hrtimer_forward_now(timer, beada->vblank_period);
 
-	/* read value */
-	len += sizeof(STATUSLINK_INFO);
-	ret = usb_bulk_msg(beada->udev,
-			usb_rcvbulkpipe(beada->udev, beada->misc_rcv_ept),
-			beada->cmd_buf, len, &len1,
-			DATA_TIMEOUT);
-	if (ret || len1 != len) {
-		DRM_DEV_ERROR(&beada->udev->dev, "usb_bulk_msg() read error %d\n", ret);
-		return -EIO;
-	}
+	return HRTIMER_RESTART;
+}
 
-	HexDump(beada->cmd_buf, len, beada->cmd_buf);
+static int beada_crtc_enable_vblank(struct drm_crtc *crtc)
+{
+	struct beada_device *beada = to_beada(crtc->dev);
 
-	/* retrive BeadaPanel device info into a local structure */
-	ret = retrivSLGetInfo(beada->cmd_buf, len, &beada->info);
-	if (ret) {
-		DRM_DEV_ERROR(&beada->udev->dev, "retrivSLGetInfo() error %d\n", ret);
-		return -EIO;
-	}
+	WRITE_ONCE(beada->vblank_enabled, true);
+	hrtimer_start(&beada->vblank_timer, beada->vblank_period, HRTIMER_MODE_REL);
 
-	switch (beada->info.os_version) {
-	case MODEL_2:
-		model = "2";
-		width = 480;
-		height = 480;
-		width_mm = 53;
-		height_mm = 53;
-		break;
-	case MODEL_2W:
-		model = "2W";
-		width = 480;
-		height = 480;
-		width_mm = 70;
-		height_mm = 70;
-		break;
-	case MODEL_3:
-		model = "3";
-		width = 480;
-		height = 320;
-		width_mm = 62;
-		height_mm = 40;
-		break;
-	case MODEL_4:
-		model = "4";
-		width = 800;
-		height = 480;
-		width_mm = 94;
-		height_mm = 56;
-		break;
-	case MODEL_3C:
-		model = "3C";
-		width = 480;
-		height = 320;
-		width_mm = 62;
-		height_mm = 40;
-		break;
-	case MODEL_4C:
-		model = "4C";
-		width = 800;
-		height = 480;
-		width_mm = 94;
-		height_mm = 56;
-		break;
-	case MODEL_5:
-		model = "5";
-		width = 800;
-		height = 480;
-		width_mm = 108;
-		height_mm = 65;
-		break;
-	case MODEL_5S:
-		model = "5S";
-		width = 800;
-		height = 480;
-		width_mm = 108;
-		height_mm = 65;
-		break;
-	case MODEL_6:
-		model = "6";
-		width = 1280;
-		height = 480;
-		width_mm = 161;
-		height_mm = 60;
-		break;
-	case MODEL_6C:
-		model = "6C";
-		width = 1280;
-		height = 480;
-		width_mm = 161;
-		height_mm = 60;
-		break;
-	case MODEL_6S:
-		model = "6S";
-		width = 1280;
-		height = 480;
-		width_mm = 161;
-		height_mm = 60;
-		break;
-	case MODEL_7C:
-		model = "7C";
-		width = 800;
-		height = 480;
-		width_mm = 62;
-		height_mm = 110;
-		break;
-	default:
-		model = "5";
-		width  = 800;
-		height = 480;
-		margin = 0;
-		width_mm = 108;
-		height_mm = 65;	
-		break;
-	}
-
-	beada->width = width;
-	beada->height = height;
-	beada->margin = margin;
-	beada->model = model;
-	beada->width_mm = width_mm;
-	beada->height_mm = height_mm;
-	
 	return 0;
 }
 
-static int beada_buf_copy(void *dst, const struct dma_buf_map *map, struct drm_framebuffer *fb, struct drm_rect *clip)
+/* may run under the vblank locks, a callback in flight stops on its own */
+static void beada_crtc_disable_vblank(struct drm_crtc *crtc)
 {
-	int ret;
+	struct beada_device *beada = to_beada(crtc->dev);
 
-	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
-	if (ret)
-		return ret;
+	WRITE_ONCE(beada->vblank_enabled, false);
+	hrtimer_try_to_cancel(&beada->vblank_timer);
+}
 
-	drm_fb_xrgb8888_to_rgb565(dst, map->vaddr, fb, clip, false);
+static void beada_vblank_set_rate(struct beada_device *beada, const struct drm_display_mode *mode)
+{
+	unsigned int hz = READ_ONCE(vblank_hz);
 
-	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+	if (!hz)
+		hz = drm_mode_vrefresh(mode);
+	if (!hz)
+		hz = 60;
 
-	return 0;
+	beada->vblank_period = ns_to_ktime(NSEC_PER_SEC / hz);
 }
 
-static void beada_fb_mark_dirty(struct drm_framebuffer *fb, const struct dma_buf_map *map, struct drm_rect *rect)
+/*
+ * Take over the page flip event of the commit being applied. It completes
+ * once the update reached the panel rather than when the commit is done,
+ * so userspace paces itself to the bus. Left alone while vblank is off.
+ */
+static struct drm_pending_vblank_event *beada_crtc_event(struct drm_crtc *crtc)
 {
-	struct beada_device *beada = to_beada(fb->dev);
-	int idx, len, height, width, ret;
-	char fmtstr[256] = {0};
+	struct drm_pending_vblank_event *event = crtc->state->event;
 
-	height = rect->y2 - rect->y1;
-	width = rect->x2 - rect->x1;
-	len = height * width * RGB565_BPP / 8;
+	if (!event || drm_crtc_vblank_get(crtc))
+		return NULL;
 
-	if (!drm_dev_enter(fb->dev, &idx))
-		return;
+	crtc->state->event = NULL;
 
-	ret = beada_buf_copy(beada->draw_buf, map, fb, rect);
-	if (ret)
-		goto err_msg;
+	return event;
+}
 
-	/* send a new tag if rect size changed */
-	if (!((beada->old_rect_x1 == rect->x1) &&
-		(beada->old_rect_y1 == rect->y1) &&
-		(beada->old_rect_x2 == rect->x2) &&
-		(beada->old_rect_y2 == rect->y2)) ) {
+static void beada_vblank_release(struct drm_device *dev, void *res)
+{
+	struct beada_device *beada = to_beada(dev);
 
-		snprintf(fmtstr, sizeof(fmtstr), "video/x-raw, format=RGB16, height=%d, width=%d, framerate=0/1", height, width);
-		ret = beada_send_tag(beada, (const char *)fmtstr);
-		if (ret < 0)
-			goto err_msg;
-	}
+	hrtimer_cancel(&beada->vblank_timer);
+}
 
-	ret = usb_bulk_msg(beada->udev, usb_sndbulkpipe(beada->udev, beada->data_snd_ept), beada->draw_buf,
-			    len, NULL, PANELLINK_MAX_DELAY);
-	
-	beada->old_rect_x1 = rect->x1;
-	beada->old_rect_y1 = rect->y1;
-	beada->old_rect_x2 = rect->x2;
-	beada->old_rect_y2 = rect->y2;
+static int beada_vblank_init(struct beada_device *beada)
+{
+	int ret;
 
-err_msg:
+	ret = drm_vblank_init(&beada->dev, 1);
 	if (ret)
-		dev_err_once(fb->dev->dev, "Failed to update display %d\n", ret);
+		return ret;
 
-	drm_dev_exit(idx);
+	hrtimer_init(&beada->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	beada->vblank_timer.function = beada_vblank_timer;
+	beada->vblank_period = ns_to_ktime(NSEC_PER_SEC / 60);
+
+	return drmm_add_action_or_reset(&beada->dev, beada_vblank_release, NULL);
 }
 
 /* ------------------------------------------------------------------ */
 /* beada connector						      */
 
 /*
- * We use fake EDID info so that userspace know that it is dealing with
- * an Acer projector, rather then listing this as an "unknown" monitor.
- * Note this assumes this driver is only ever used with the Acer C120, if we
- * add support for other devices the vendor and model should be parameterized.
+ * We use fake EDID info so that userspace knows what it is dealing with,
+ * rather then listing this as an "unknown" monitor. This is only a template:
+ * beada_edid_setup() copies it into each beada_device and fills in that
+ * panel's resolution, size, model and serial.
  */
-static struct edid beada_edid = {
+static const struct edid beada_edid = {
 	.header		= { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 },
 	.mfg_id		= { 0x3b, 0x05 },	/* "NXE" */
 	.prod_code	= { 0x01, 0x10 },	/* 1001h */
@@ -435,8 +2773,10 @@ static struct edid beada_edid = {
 
 static int beada_conn_get_modes(struct drm_connector *connector)
 {
-	drm_connector_update_edid_property(connector, &beada_edid);
-	return drm_add_edid_modes(connector, &beada_edid);
+	struct beada_device *beada = to_beada(connector->dev);
+
+	drm_connector_update_edid_property(connector, &beada->edid);
+	return drm_add_edid_modes(connector, &beada->edid);
 }
 
 static const struct drm_connector_helper_funcs beada_conn_helper_funcs = {
@@ -458,60 +2798,518 @@ static int beada_conn_init(struct beada_device *beada)
 				  &beada_conn_funcs, DRM_MODE_CONNECTOR_USB);
 }
 
-static void beada_pipe_enable(struct drm_simple_display_pipe *pipe,
-				 struct drm_crtc_state *crtc_state,
-				 struct drm_plane_state *plane_state)
+/* ------------------------------------------------------------------ */
+/* beada planes and crtc					      */
+
+static int beada_primary_atomic_check(struct drm_plane *plane, struct drm_atomic_state *state)
 {
-	struct beada_device *beada = to_beada(pipe->crtc.dev);
-	struct drm_shadow_plane_state *shadow_plane_state = to_drm_shadow_plane_state(plane_state);
-	struct drm_framebuffer *fb = plane_state->fb;
-	struct drm_rect rect = {
-		.x1 = 0,
-		.x2 = fb->width,
-		.y1 = 0,
-		.y2 = fb->height,
-	};
+	struct drm_plane_state *new_state = drm_atomic_get_new_plane_state(state, plane);
+	struct drm_crtc_state *crtc_state = NULL;
+
+	if (new_state->crtc)
+		crtc_state = drm_atomic_get_new_crtc_state(state, new_state->crtc);
+
+	return drm_atomic_helper_check_plane_state(new_state, crtc_state,
+						   DRM_PLANE_HELPER_NO_SCALING,
+						   DRM_PLANE_HELPER_NO_SCALING,
+						   false, false);
+}
+
+static void beada_primary_atomic_update(struct drm_plane *plane, struct drm_atomic_state *state)
+{
+	struct beada_device *beada = to_beada(plane->dev);
+	struct drm_plane_state *old_state = drm_atomic_get_old_plane_state(state, plane);
+	struct drm_plane_state *new_state = plane->state;
+	struct drm_framebuffer *fb = new_state->fb;
+	struct drm_atomic_helper_damage_iter iter;
+	struct beada_damage damage = { .num_clips = 0 };
+	struct drm_rect clip;
+
+	if (!new_state->visible || !beada->crtc.state->active)
+		return;
+
+	/* keep the clips apart, the flush worker decides whether to merge them */
+	drm_atomic_helper_damage_iter_init(&iter, old_state, new_state);
+	drm_atomic_for_each_plane_damage(&iter, &clip) {
+		trace_beada_damage(fb->dev->dev, &clip, beada_rect_bytes(&clip));
+		beada_damage_add(&damage, &clip);
+	}
+
+	if (damage.num_clips)
+		beada_fb_mark_dirty(fb, &damage);
+}
+
+static unsigned int beada_plane_layer(struct beada_device *beada, struct drm_plane *plane)
+{
+	if (plane == &beada->cursor_plane)
+		return BEADA_LAYERS - 1;
 
-	beada_fb_mark_dirty(fb, &shadow_plane_state->data[0], &rect);
+	return plane - beada->overlays;
 }
 
-static void beada_pipe_disable(struct drm_simple_display_pipe *pipe)
+static int beada_layer_atomic_check(struct drm_plane *plane, struct drm_atomic_state *state)
 {
-	//struct beada_device *beada = to_beada(pipe->crtc.dev);
+	struct beada_device *beada = to_beada(plane->dev);
+	struct drm_plane_state *new_state = drm_atomic_get_new_plane_state(state, plane);
+	struct drm_crtc_state *crtc_state = NULL;
 
+	if (plane == &beada->cursor_plane && new_state->fb &&
+	    (new_state->crtc_w > BEADA_CURSOR_SIZE || new_state->crtc_h > BEADA_CURSOR_SIZE))
+		return -EINVAL;
+
+	if (new_state->crtc)
+		crtc_state = drm_atomic_get_new_crtc_state(state, new_state->crtc);
+
+	return drm_atomic_helper_check_plane_state(new_state, crtc_state,
+						   DRM_PLANE_HELPER_NO_SCALING,
+						   DRM_PLANE_HELPER_NO_SCALING,
+						   true, true);
 }
 
-static void beada_pipe_update(struct drm_simple_display_pipe *pipe,
-				 struct drm_plane_state *old_state)
+/*
+ * Hand an overlay or the cursor to the flush worker and resend only what
+ * changed on screen: the plane's damage if it stayed in place, otherwise
+ * what it covered before and covers now. Primary plane contents under it
+ * are converted again and the layers blended on top.
+ */
+static void beada_layer_atomic_update(struct drm_plane *plane, struct drm_atomic_state *state)
 {
-	struct drm_plane_state *state = pipe->plane.state;
-	struct drm_shadow_plane_state *shadow_plane_state = to_drm_shadow_plane_state(state);
-	struct drm_framebuffer *fb = state->fb;
+	struct beada_device *beada = to_beada(plane->dev);
+	struct drm_plane_state *old_state = drm_atomic_get_old_plane_state(state, plane);
+	struct drm_plane_state *new_state = plane->state;
+	struct drm_framebuffer *fb = beada->primary.state->fb;
+	struct beada_damage damage = { .num_clips = 0 };
+	struct beada_layer layer = { .fb = NULL };
+	struct drm_atomic_helper_damage_iter iter;
 	struct drm_rect rect;
+	bool overlap;
+	int ret;
+
+	if (new_state->visible) {
+		layer.fb = new_state->fb;
+		layer.rect = new_state->dst;
+		layer.src_x = new_state->src.x1 >> 16;
+		layer.src_y = new_state->src.y1 >> 16;
+	}
+
+	mutex_lock(&beada->fb_update.lock);
+	ret = beada_layer_copy(beada, &beada->fb_update.layers[beada_plane_layer(beada, plane)],
+			       &layer);
+	beada->fb_update.layers_changed = true;
+	mutex_unlock(&beada->fb_update.lock);
 
-	if (!pipe->crtc.state->active)
+	if (ret)
+		dev_err_once(plane->dev->dev, "Failed to map plane %d\n", ret);
+
+	if (!fb || !beada->crtc.state->active)
 		return;
 
-	if (drm_atomic_helper_damage_merged(old_state, state, &rect))
-		beada_fb_mark_dirty(fb, &shadow_plane_state->data[0], &rect);
+	rect = old_state->dst;
+	overlap = old_state->visible && new_state->visible &&
+		  drm_rect_intersect(&rect, &new_state->dst);
+
+	if (old_state->visible == new_state->visible &&
+	    drm_rect_equals(&old_state->dst, &new_state->dst) &&
+	    drm_rect_equals(&old_state->src, &new_state->src)) {
+		if (!new_state->visible)
+			return;
+
+		drm_atomic_helper_damage_iter_init(&iter, old_state, new_state);
+		drm_atomic_for_each_plane_damage(&iter, &rect) {
+			drm_rect_translate(&rect, layer.rect.x1 - layer.src_x,
+					   layer.rect.y1 - layer.src_y);
+			beada_damage_add(&damage, &rect);
+		}
+	} else if (overlap) {
+		/* overlapping footprints go out as one rect */
+		rect = old_state->dst;
+		beada_rect_union(&rect, &new_state->dst);
+		beada_damage_add(&damage, &rect);
+	} else {
+		if (old_state->visible)
+			beada_damage_add(&damage, &old_state->dst);
+		if (new_state->visible)
+			beada_damage_add(&damage, &new_state->dst);
+	}
+
+	if (damage.num_clips)
+		beada_fb_mark_dirty(fb, &damage);
 }
 
-static const struct drm_simple_display_pipe_funcs beada_pipe_funcs = {
-	.enable	    = beada_pipe_enable,
-	.disable    = beada_pipe_disable,
-	.update	    = beada_pipe_update,
-	DRM_GEM_SIMPLE_DISPLAY_PIPE_SHADOW_PLANE_FUNCS,
+/*
+ * No shadow-plane helpers: they would vmap every framebuffer for each
+ * commit, while the flush worker maps through beada_fb_vmap() and its
+ * cache. prepare_fb only sets up the fence of imported buffers.
+ */
+static const struct drm_plane_helper_funcs beada_primary_helper_funcs = {
+	.prepare_fb	= drm_gem_plane_helper_prepare_fb,
+	.atomic_check	= beada_primary_atomic_check,
+	.atomic_update	= beada_primary_atomic_update,
+};
+
+static const struct drm_plane_helper_funcs beada_layer_helper_funcs = {
+	.prepare_fb	= drm_gem_plane_helper_prepare_fb,
+	.atomic_check	= beada_layer_atomic_check,
+	.atomic_update	= beada_layer_atomic_update,
+};
+
+static const struct drm_plane_funcs beada_plane_funcs = {
+	.update_plane	= drm_atomic_helper_update_plane,
+	.disable_plane	= drm_atomic_helper_disable_plane,
+	.destroy	= drm_plane_cleanup,
+	.reset		= drm_atomic_helper_plane_reset,
+	.atomic_duplicate_state = drm_atomic_helper_plane_duplicate_state,
+	.atomic_destroy_state = drm_atomic_helper_plane_destroy_state,
+};
+
+static const uint32_t beada_primary_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_RGB565,
 };
 
-static const uint32_t beada_pipe_formats[] = {
+static const uint32_t beada_overlay_formats[] = {
+	DRM_FORMAT_ARGB8888,
 	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_RGB565,
+};
+
+static const uint32_t beada_cursor_formats[] = {
+	DRM_FORMAT_ARGB8888,
 };
 
-static const uint64_t beada_pipe_modifiers[] = {
+static const uint64_t beada_plane_modifiers[] = {
 	DRM_FORMAT_MOD_LINEAR,
 	DRM_FORMAT_MOD_INVALID
 };
 
+/* the primary plane has to be on whenever the crtc is */
+static int beada_crtc_atomic_check(struct drm_crtc *crtc, struct drm_atomic_state *state)
+{
+	struct drm_crtc_state *crtc_state = drm_atomic_get_new_crtc_state(state, crtc);
+	bool has_primary = crtc_state->plane_mask & drm_plane_mask(crtc->primary);
+
+	if (has_primary != crtc_state->enable)
+		return -EINVAL;
+
+	return drm_atomic_add_affected_planes(state, crtc);
+}
+
+static void beada_crtc_atomic_enable(struct drm_crtc *crtc, struct drm_atomic_state *state)
+{
+	struct beada_device *beada = to_beada(crtc->dev);
+	struct drm_framebuffer *fb = beada->primary.state->fb;
+	struct beada_damage damage = {
+		.clips[0] = {
+			.x1 = 0,
+			.x2 = fb->width,
+			.y1 = 0,
+			.y2 = fb->height,
+		},
+		.num_clips = 1,
+	};
+
+	beada_vblank_set_rate(beada, &crtc->state->mode);
+	drm_crtc_vblank_on(crtc);
+
+	/* the panel contents are unknown after the crtc was down */
+	mutex_lock(&beada->fb_update.lock);
+	beada->fb_update.resync = true;
+	beada->fb_update.open = true;
+	mutex_unlock(&beada->fb_update.lock);
+
+	/* goes out with the plane updates, from atomic_flush */
+	beada_fb_mark_dirty(fb, &damage);
+}
+
+static void beada_crtc_atomic_disable(struct drm_crtc *crtc, struct drm_atomic_state *state)
+{
+	struct beada_device *beada = to_beada(crtc->dev);
+
+	/* let the last update reach the panel before the crtc goes down */
+	flush_delayed_work(&beada->fb_update.work);
+	beada_frames_drain(beada);
+	beada_layers_release(beada);
+	beada_map_cache_release(beada);
+
+	/* sends the flips still armed, the disabling commit's goes out here */
+	drm_crtc_vblank_off(crtc);
+
+	spin_lock_irq(&crtc->dev->event_lock);
+	if (crtc->state->event) {
+		drm_crtc_send_vblank_event(crtc, crtc->state->event);
+		crtc->state->event = NULL;
+	}
+	spin_unlock_irq(&crtc->dev->event_lock);
+}
+
+/* all planes are updated, the flip completes with the flush picking them up */
+static void beada_crtc_atomic_begin(struct drm_crtc *crtc, struct drm_atomic_state *state)
+{
+	beada_fb_update_open(to_beada(crtc->dev));
+}
+
+static void beada_crtc_atomic_flush(struct drm_crtc *crtc, struct drm_atomic_state *state)
+{
+	beada_fb_update_commit(to_beada(crtc->dev), beada_crtc_event(crtc));
+}
+
+static const struct drm_crtc_helper_funcs beada_crtc_helper_funcs = {
+	.atomic_check	= beada_crtc_atomic_check,
+	.atomic_enable	= beada_crtc_atomic_enable,
+	.atomic_disable	= beada_crtc_atomic_disable,
+	.atomic_begin	= beada_crtc_atomic_begin,
+	.atomic_flush	= beada_crtc_atomic_flush,
+};
+
+static const struct drm_crtc_funcs beada_crtc_funcs = {
+	.reset			= drm_atomic_helper_crtc_reset,
+	.destroy		= drm_crtc_cleanup,
+	.set_config		= drm_atomic_helper_set_config,
+	.page_flip		= drm_atomic_helper_page_flip,
+	.atomic_duplicate_state	= drm_atomic_helper_crtc_duplicate_state,
+	.atomic_destroy_state	= drm_atomic_helper_crtc_destroy_state,
+	.enable_vblank		= beada_crtc_enable_vblank,
+	.disable_vblank		= beada_crtc_disable_vblank,
+};
+
+static int beada_crtc_init(struct beada_device *beada)
+{
+	struct drm_device *dev = &beada->dev;
+	struct drm_plane *plane;
+	unsigned int i;
+	int ret;
+
+	ret = drm_universal_plane_init(dev, &beada->primary, 0, &beada_plane_funcs,
+				       beada_primary_formats, ARRAY_SIZE(beada_primary_formats),
+				       beada_plane_modifiers, DRM_PLANE_TYPE_PRIMARY, NULL);
+	if (ret)
+		return ret;
+	drm_plane_helper_add(&beada->primary, &beada_primary_helper_funcs);
+	drm_plane_enable_fb_damage_clips(&beada->primary);
+	drm_plane_create_zpos_immutable_property(&beada->primary, 0);
+
+	ret = drm_universal_plane_init(dev, &beada->cursor_plane, 0, &beada_plane_funcs,
+				       beada_cursor_formats, ARRAY_SIZE(beada_cursor_formats),
+				       beada_plane_modifiers, DRM_PLANE_TYPE_CURSOR, NULL);
+	if (ret)
+		return ret;
+	drm_plane_helper_add(&beada->cursor_plane, &beada_layer_helper_funcs);
+	drm_plane_create_zpos_immutable_property(&beada->cursor_plane, BEADA_LAYERS);
+
+	ret = drm_crtc_init_with_planes(dev, &beada->crtc, &beada->primary, &beada->cursor_plane,
+					&beada_crtc_funcs, NULL);
+	if (ret)
+		return ret;
+	drm_crtc_helper_add(&beada->crtc, &beada_crtc_helper_funcs);
+
+	/* stacked between primary and cursor, in the order of beada->layers */
+	for (i = 0; i < BEADA_OVERLAYS; i++) {
+		plane = &beada->overlays[i];
+		ret = drm_universal_plane_init(dev, plane, drm_crtc_mask(&beada->crtc),
+					       &beada_plane_funcs, beada_overlay_formats,
+					       ARRAY_SIZE(beada_overlay_formats),
+					       beada_plane_modifiers, DRM_PLANE_TYPE_OVERLAY, NULL);
+		if (ret)
+			return ret;
+		drm_plane_helper_add(plane, &beada_layer_helper_funcs);
+		drm_plane_enable_fb_damage_clips(plane);
+		drm_plane_create_zpos_immutable_property(plane, i + 1);
+	}
+
+	ret = drm_simple_encoder_init(dev, &beada->encoder, DRM_MODE_ENCODER_NONE);
+	if (ret)
+		return ret;
+	beada->encoder.possible_crtcs = drm_crtc_mask(&beada->crtc);
+
+	return drm_connector_attach_encoder(&beada->conn, &beada->encoder);
+}
+
+#if defined(CONFIG_DEBUG_FS)
+static int beada_stats_show(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct beada_device *beada = to_beada(node->minor->dev);
+	struct beada_stats *stats = &beada->stats;
+
+	seq_printf(m, "frames:            %lu\n", stats->frames);
+	seq_printf(m, "frames_dropped:    %lu\n", stats->frames_dropped);
+	seq_printf(m, "frames_streamed:   %lu\n", stats->frames_streamed);
+	seq_printf(m, "commits_coalesced: %lu\n", stats->commits_coalesced);
+	seq_printf(m, "clips:             %lu\n", stats->clips);
+	seq_printf(m, "tag_hits:          %lu\n", stats->tag_hits);
+	seq_printf(m, "tag_misses:        %lu\n", stats->tag_misses);
+	seq_printf(m, "uploads_split:     %lu\n", stats->uploads_split);
+	seq_printf(m, "uploads_merged:    %lu\n", stats->uploads_merged);
+	seq_printf(m, "uploads_snapped:   %lu\n", stats->uploads_snapped);
+	seq_printf(m, "bytes_unchanged:   %lu\n", stats->bytes_unchanged);
+	seq_printf(m, "bytes_hashed:      %lu\n", stats->bytes_hashed);
+	seq_printf(m, "flushes_skipped:   %lu\n", stats->flushes_skipped);
+	seq_printf(m, "bytes_zero_copy:   %lu\n", stats->bytes_zero_copy);
+	seq_printf(m, "bytes_sent:        %lu\n", stats->bytes_sent);
+	seq_printf(m, "tags_sent:         %lu\n", stats->tags_sent);
+	seq_printf(m, "map_hits:          %lu\n", stats->map_hits);
+	seq_printf(m, "map_misses:        %lu\n", stats->map_misses);
+	seq_printf(m, "link_tag_ns:       %u\n", beada->link.tag_ns);
+	seq_printf(m, "link_byte_ps:      %u\n", beada->link.byte_ps);
+	seq_printf(m, "throughput_kBps:   %llu\n",
+		   div64_u64((u64)stats->bytes_sent * USEC_PER_SEC / 1024,
+			     max_t(s64, ktime_us_delta(ktime_get(), stats->since), 1)));
+
+	return 0;
+}
+
+static int beada_errors_show(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct beada_device *beada = to_beada(node->minor->dev);
+	unsigned long *errors = beada->stats.errors;
+	int i;
+
+	for (i = 1; i < BEADA_ERRNO_MAX; i++)
+		if (errors[i])
+			seq_printf(m, "%-12pe %lu\n", ERR_PTR(-i), errors[i]);
+	if (errors[0])
+		seq_printf(m, "%-12s %lu\n", "other", errors[0]);
+
+	return 0;
+}
+
+static void beada_hist_show(struct seq_file *m, const char *name,
+			    const struct beada_hist *hist)
+{
+	int i;
+
+	seq_printf(m, "%s:\n", name);
+	for (i = 0; i < BEADA_HIST_BUCKETS; i++) {
+		if (!hist->buckets[i])
+			continue;
+		if (i == BEADA_HIST_BUCKETS - 1)
+			seq_printf(m, "  %10lu+ us %lu\n", 1UL << (i - 1), hist->buckets[i]);
+		else
+			seq_printf(m, "  %10lu-%lu us %lu\n", i ? 1UL << (i - 1) : 0,
+				   (1UL << i) - 1, hist->buckets[i]);
+	}
+}
+
+static int beada_latency_show(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct beada_device *beada = to_beada(node->minor->dev);
+
+	beada_hist_show(m, "map", &beada->stats.map_us);
+	beada_hist_show(m, "convert", &beada->stats.convert_us);
+	beada_hist_show(m, "transfer", &beada->stats.transfer_us);
+	beada_hist_show(m, "commit_to_first_pixels", &beada->stats.first_pixels_us);
+	beada_hist_show(m, "commit_to_panel", &beada->stats.latency_us);
+
+	return 0;
+}
+
+static int beada_sched_file_show(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct beada_device *beada = to_beada(node->minor->dev);
+
+	beada_sched_show(m, &beada->sched);
+
+	return 0;
+}
+
+/* any write to "reset" clears all statistics */
+static ssize_t beada_reset_write(struct file *file, const char __user *ubuf,
+				 size_t len, loff_t *offp)
+{
+	struct beada_device *beada = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&beada->frame_lock, flags);
+	memset(&beada->stats, 0, sizeof(beada->stats));
+	beada->stats.since = ktime_get();
+	spin_unlock_irqrestore(&beada->frame_lock, flags);
+
+	return len;
+}
+
+static const struct file_operations beada_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = beada_reset_write,
+	.llseek = noop_llseek,
+};
+
+#ifdef BEADA_PROTO_TRACE
+static int beada_protocol_show(struct seq_file *m, void *data)
+{
+	struct drm_info_node *node = m->private;
+	struct beada_device *beada = to_beada(node->minor->dev);
+	struct beada_trace_entry *entry, *trace;
+	unsigned int i, head, count;
+	unsigned long flags;
+
+	/* snapshot, so the dump does not hold off URB completions */
+	trace = kmalloc_array(BEADA_TRACE_ENTRIES, sizeof(*trace), GFP_KERNEL);
+	if (!trace)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&beada->trace_lock, flags);
+	memcpy(trace, beada->trace, sizeof(beada->trace));
+	head = beada->trace_head;
+	spin_unlock_irqrestore(&beada->trace_lock, flags);
+
+	count = min_t(unsigned int, head, BEADA_TRACE_ENTRIES);
+	for (i = head - count; i != head; i++) {
+		entry = &trace[i % BEADA_TRACE_ENTRIES];
+		seq_printf(m, "%lld %s %s, %u bytes\n", ktime_to_us(entry->time),
+			   entry->out ? ">" : "<", entry->what, entry->len);
+		seq_hex_dump(m, "  ", DUMP_PREFIX_OFFSET, 16, 1, entry->data,
+			     min_t(unsigned int, entry->len, BEADA_TRACE_BYTES), true);
+	}
+
+	kfree(trace);
+	return 0;
+}
+#endif
+
+static const struct drm_info_list beada_debugfs_list[] = {
+	{ "stats", beada_stats_show, 0 },
+	{ "errors", beada_errors_show, 0 },
+	{ "latency", beada_latency_show, 0 },
+	{ "sched", beada_sched_file_show, 0 },
+#ifdef BEADA_PROTO_TRACE
+	{ "protocol", beada_protocol_show, 0 },
+#endif
+};
+
+static void beada_debugfs_init(struct drm_minor *minor)
+{
+	struct beada_device *beada = to_beada(minor->dev);
+	struct dentry *root;
+
+	root = debugfs_create_dir("beada", minor->debugfs_root);
+	drm_debugfs_create_files(beada_debugfs_list, ARRAY_SIZE(beada_debugfs_list),
+				 root, minor);
+	debugfs_create_file("reset", 0200, root, beada, &beada_reset_fops);
+	debugfs_create_u32("weight", 0644, root, &beada->sched.weight);
+	debugfs_create_u32("max_fps", 0644, root, &beada->max_fps);
+}
+#endif
+
+/*
+ * The USB interface cannot do DMA, attach imported dma-bufs to the host
+ * controller instead. Their sg table is then mapped once at import for the
+ * device the URBs go out through, rather than bounced or mapped per frame.
+ */
+static struct drm_gem_object *beada_gem_prime_import(struct drm_device *dev,
+						      struct dma_buf *dma_buf)
+{
+	struct beada_device *beada = to_beada(dev);
+
+	if (!beada->dmadev)
+		return ERR_PTR(-ENODEV);
+
+	return drm_gem_prime_import_dev(dev, dma_buf, beada->dmadev);
+}
+
 DEFINE_DRM_GEM_FOPS(beada_fops);
 
 static const struct drm_driver beada_drm_driver = {
@@ -525,6 +3323,10 @@ static const struct drm_driver beada_drm_driver = {
 
 	.fops		 = &beada_fops,
 	DRM_GEM_SHMEM_DRIVER_OPS,
+	.gem_prime_import = beada_gem_prime_import,
+#if defined(CONFIG_DEBUG_FS)
+	.debugfs_init	 = beada_debugfs_init,
+#endif
 };
 
 static const struct drm_mode_config_funcs beada_mode_config_funcs = {
@@ -542,6 +3344,8 @@ static void beada_mode_config_setup(struct beada_device *beada)
 	dev->mode_config.max_width = beada->width;
 	dev->mode_config.min_height = beada->height;
 	dev->mode_config.max_height = beada->height;
+	dev->mode_config.cursor_width = BEADA_CURSOR_SIZE;
+	dev->mode_config.cursor_height = BEADA_CURSOR_SIZE;
 }
 
 static int beada_edid_block_checksum(u8 *raw_edid)
@@ -557,44 +3361,59 @@ static int beada_edid_block_checksum(u8 *raw_edid)
 	return crc;
 }
 
+/*
+ * A descriptor string is 13 bytes, ended by a newline if shorter and padded
+ * with spaces after that.
+ */
+static void beada_edid_set_string(u8 str[13], const char *s)
+{
+	size_t len = strnlen(s, 13);
+
+	memset(str, ' ', 13);
+	memcpy(str, s, len);
+	if (len < 13)
+		str[len] = '\n';
+}
+
 static void beada_edid_setup(struct beada_device *beada)
 {
+	struct edid *edid = &beada->edid;
 	unsigned int width, height, width_mm, height_mm;
 	char buf[16];
 
+	*edid = beada_edid;
+
 	width = beada->width;
 	height = beada->height;
 	width_mm = beada->width_mm;
 	height_mm = beada->height_mm;
 
-	beada_edid.detailed_timings[0].data.pixel_data.hactive_lo = width % 256;
-	beada_edid.detailed_timings[0].data.pixel_data.hactive_hblank_hi &= 0x0f;
-	beada_edid.detailed_timings[0].data.pixel_data.hactive_hblank_hi |= \
+	edid->detailed_timings[0].data.pixel_data.hactive_lo = width % 256;
+	edid->detailed_timings[0].data.pixel_data.hactive_hblank_hi &= 0x0f;
+	edid->detailed_timings[0].data.pixel_data.hactive_hblank_hi |= \
 						((u8)(width / 256) << 4);
 
-	beada_edid.detailed_timings[0].data.pixel_data.vactive_lo = height % 256;
-	beada_edid.detailed_timings[0].data.pixel_data.vactive_vblank_hi &= 0x0f;
-	beada_edid.detailed_timings[0].data.pixel_data.vactive_vblank_hi |= \
+	edid->detailed_timings[0].data.pixel_data.vactive_lo = height % 256;
+	edid->detailed_timings[0].data.pixel_data.vactive_vblank_hi &= 0x0f;
+	edid->detailed_timings[0].data.pixel_data.vactive_vblank_hi |= \
 						((u8)(height / 256) << 4);
 
-	beada_edid.detailed_timings[0].data.pixel_data.width_mm_lo = \
+	edid->detailed_timings[0].data.pixel_data.width_mm_lo = \
 							width_mm % 256;
-	beada_edid.detailed_timings[0].data.pixel_data.height_mm_lo = \
+	edid->detailed_timings[0].data.pixel_data.height_mm_lo = \
 							height_mm % 256;
-	beada_edid.detailed_timings[0].data.pixel_data.width_height_mm_hi = \
+	edid->detailed_timings[0].data.pixel_data.width_height_mm_hi = \
 					((u8)(width_mm / 256) << 4) | \
 					((u8)(height_mm / 256) & 0xf);
 
-	memcpy(&beada_edid.detailed_timings[2].data.other_data.data.str.str,
-		beada->model, strlen(beada->model));
-
-	snprintf(buf, 16, "%02X%02X%02X%02X\n",
-		beada->id[4], beada->id[5], beada->id[6], beada->id[7]);
+	beada_edid_set_string(edid->detailed_timings[2].data.other_data.data.str.str,
+			      beada->model);
 
-	memcpy(&beada_edid.detailed_timings[3].data.other_data.data.str.str,
-		buf, strlen(buf));
+	snprintf(buf, sizeof(buf), "%02X%02X%02X%02X",
+		 beada->id[4], beada->id[5], beada->id[6], beada->id[7]);
+	beada_edid_set_string(edid->detailed_timings[3].data.other_data.data.str.str, buf);
 
-	beada_edid.checksum = beada_edid_block_checksum((u8*)&beada_edid);
+	edid->checksum = beada_edid_block_checksum((u8*)edid);
 }
 
 
@@ -636,6 +3455,8 @@ static int beada_usb_probe(struct usb_interface *interface,
 		goto err_put_device;
 	}
 
+	beada_proto_trace_init(beada);
+
 	ret = beada_misc_request(beada);
 	if (ret) {
 		DRM_DEV_ERROR(&beada->udev->dev, "cant't get screen info.\n");
@@ -651,9 +3472,27 @@ static int beada_usb_probe(struct usb_interface *interface,
 	beada_mode_config_setup(beada);
 	beada_edid_setup(beada);
 
-	beada->draw_buf = drmm_kmalloc(&beada->dev, beada->height * beada->width * RGB565_BPP / 8 + beada->margin, GFP_KERNEL);
-	if (!beada->draw_buf) {
-		DRM_DEV_ERROR(&beada->udev->dev, "beada->cmd_buf init failed\n");
+	ret = beada_vblank_init(beada);
+	if (ret) {
+		DRM_DEV_ERROR(&beada->udev->dev, "beada_vblank_init() return %d\n", ret);
+		goto err_put_device;
+	}
+
+	ret = beada_frames_init(beada);
+	if (ret) {
+		DRM_DEV_ERROR(&beada->udev->dev, "beada_frames_init() return %d\n", ret);
+		goto err_put_device;
+	}
+
+	ret = beada_shadow_init(beada);
+	if (ret) {
+		DRM_DEV_ERROR(&beada->udev->dev, "beada_shadow_init() return %d\n", ret);
+		goto err_put_device;
+	}
+
+	ret = beada_fb_update_init(beada);
+	if (ret) {
+		DRM_DEV_ERROR(&beada->udev->dev, "beada_fb_update_init() return %d\n", ret);
 		goto err_put_device;
 	}
 
@@ -663,20 +3502,12 @@ static int beada_usb_probe(struct usb_interface *interface,
 		goto err_put_device;
 	}
 
-	ret = drm_simple_display_pipe_init(&beada->dev,
-					   &beada->pipe,
-					   &beada_pipe_funcs,
-					   beada_pipe_formats,
-					   ARRAY_SIZE(beada_pipe_formats),
-					   beada_pipe_modifiers,
-					   &beada->conn);
+	ret = beada_crtc_init(beada);
 	if (ret) {
-		DRM_DEV_ERROR(&beada->udev->dev, "drm_simple_display_pipe_init() return %d\n", ret);
+		DRM_DEV_ERROR(&beada->udev->dev, "beada_crtc_init() return %d\n", ret);
 		goto err_put_device;
 	}
 
-	drm_plane_enable_fb_damage_clips(&beada->pipe.plane);
-
 	drm_mode_config_reset(dev);
 
 	usb_set_intfdata(interface, dev);
@@ -709,6 +3540,8 @@ static void beada_usb_disconnect(struct usb_interface *interface)
 	put_device(beada->dmadev);
 	beada->dmadev = NULL;
 	drm_dev_unplug(dev);
+	beada_fb_update_cancel(beada);
+	usb_kill_anchored_urbs(&beada->anchor);
 	drm_atomic_helper_shutdown(dev);
 
 	DRM_DEV_DEBUG(&beada->udev->dev, "--------------beada_usb_disconnect() exit\n");
@@ -727,6 +3560,37 @@ static struct usb_driver beada_usb_driver = {
 	.id_table = id_table,
 };
 
-module_usb_driver(beada_usb_driver);
+#ifdef BEADA_KUNIT_TEST
+#include "beada_test.c"
+#else
+static inline int beada_test_run(void) { return 0; }
+static inline void beada_test_release(void) { }
+#endif
+
+static int __init beada_init(void)
+{
+	int ret;
+
+	beada_convert_init();
+
+	ret = beada_test_run();
+	if (ret)
+		return ret;
+
+	ret = usb_register(&beada_usb_driver);
+	if (ret)
+		beada_test_release();
+
+	return ret;
+}
+
+static void __exit beada_exit(void)
+{
+	usb_deregister(&beada_usb_driver);
+	beada_test_release();
+}
+
+module_init(beada_init);
+module_exit(beada_exit);
 MODULE_AUTHOR("Hans de Goede <hdegoede@redhat.com>");
 MODULE_LICENSE("GPL");
@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Vectorized XRGB8888 to RGB565 conversion with runtime CPU feature
+ * dispatch. drm_fb_xrgb8888_to_rgb565() stays the reference the vector
+ * kernels are checked against, and the fallback when none is usable.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#include <asm/simd.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+#ifdef CONFIG_ARM64
+#include <asm/cpufeature.h>
+#include <asm/neon.h>
+#endif
+
+#include <drm/drm_format_helper.h>
+#include <drm/drm_framebuffer.h>
+#include <drm/drm_rect.h>
+
+#include "beada_convert.h"
+
+#define BEADA_TEST_WIDTH	71
+#define BEADA_TEST_HEIGHT	5
+
+typedef void (*beada_line_fn)(u16 *dst, const u32 *src, unsigned int pixels);
+
+static beada_line_fn beada_line;
+static const char *beada_line_name;
+
+#ifdef CONFIG_X86
+static const u32 beada_sse2_mask[3][4] __aligned(16) = {
+	{ 0xf800, 0xf800, 0xf800, 0xf800 },
+	{ 0x07e0, 0x07e0, 0x07e0, 0x07e0 },
+	{ 0x001f, 0x001f, 0x001f, 0x001f },
+};
+
+static void beada_line_sse2(u16 *dst, const u32 *src, unsigned int pixels)
+{
+	u32 pix;
+
+	/*
+	 * 8 pixels at a time. packssdw saturates signed, so the 16 bit
+	 * results are sign extended first to make the pack exact.
+	 */
+	for (; pixels >= 8; pixels -= 8, src += 8, dst += 8) {
+		asm volatile("movdqu   (%[src]), %%xmm0\n\t"
+			     "movdqu 16(%[src]), %%xmm3\n\t"
+			     "movdqa %%xmm0, %%xmm1\n\t"
+			     "movdqa %%xmm0, %%xmm2\n\t"
+			     "movdqa %%xmm3, %%xmm4\n\t"
+			     "movdqa %%xmm3, %%xmm5\n\t"
+			     "psrld $8, %%xmm0\n\t"
+			     "psrld $5, %%xmm1\n\t"
+			     "psrld $3, %%xmm2\n\t"
+			     "psrld $8, %%xmm3\n\t"
+			     "psrld $5, %%xmm4\n\t"
+			     "psrld $3, %%xmm5\n\t"
+			     "pand %[r], %%xmm0\n\t"
+			     "pand %[g], %%xmm1\n\t"
+			     "pand %[b], %%xmm2\n\t"
+			     "pand %[r], %%xmm3\n\t"
+			     "pand %[g], %%xmm4\n\t"
+			     "pand %[b], %%xmm5\n\t"
+			     "por %%xmm1, %%xmm0\n\t"
+			     "por %%xmm2, %%xmm0\n\t"
+			     "por %%xmm4, %%xmm3\n\t"
+			     "por %%xmm5, %%xmm3\n\t"
+			     "pslld $16, %%xmm0\n\t"
+			     "psrad $16, %%xmm0\n\t"
+			     "pslld $16, %%xmm3\n\t"
+			     "psrad $16, %%xmm3\n\t"
+			     "packssdw %%xmm3, %%xmm0\n\t"
+			     "movdqu %%xmm0, (%[dst])\n\t"
+			     :
+			     : [src] "r" (src), [dst] "r" (dst),
+			       [r] "m" (beada_sse2_mask[0]),
+			       [g] "m" (beada_sse2_mask[1]),
+			       [b] "m" (beada_sse2_mask[2])
+			     : "memory");
+	}
+
+	for (; pixels; pixels--) {
+		pix = *src++;
+		*dst++ = ((pix & 0x00F80000) >> 8) |
+			 ((pix & 0x0000FC00) >> 5) |
+			 ((pix & 0x000000F8) >> 3);
+	}
+}
+#endif
+
+static void beada_simd_begin(void)
+{
+#ifdef CONFIG_X86
+	kernel_fpu_begin();
+#endif
+#ifdef CONFIG_ARM64
+	kernel_neon_begin();
+#endif
+}
+
+static void beada_simd_end(void)
+{
+#ifdef CONFIG_X86
+	kernel_fpu_end();
+#endif
+#ifdef CONFIG_ARM64
+	kernel_neon_end();
+#endif
+}
+
+bool beada_convert_xrgb8888_to_rgb565(void *dst, const void *vaddr,
+				      unsigned int pitch,
+				      const struct drm_rect *clip)
+{
+	unsigned int pixels = drm_rect_width(clip);
+	const u8 *src;
+	u16 *out = dst;
+	int y;
+
+	if (!beada_line || !may_use_simd())
+		return false;
+
+	src = (const u8 *)vaddr + clip->y1 * pitch + clip->x1 * sizeof(u32);
+
+	beada_simd_begin();
+	for (y = clip->y1; y < clip->y2; y++) {
+		beada_line(out, (const u32 *)src, pixels);
+		src += pitch;
+		out += pixels;
+	}
+	beada_simd_end();
+
+	return true;
+}
+
+/* the vector kernel has to match the generic helper bit for bit */
+static bool beada_convert_selftest(void)
+{
+	struct drm_framebuffer fb = {
+		.pitches = { BEADA_TEST_WIDTH * sizeof(u32) },
+	};
+	struct drm_rect clip;
+	u16 *ref, *out;
+	u32 *src, seed = 1;
+	size_t len;
+	bool ok = false;
+	int i;
+
+	/* odd clip width and offset to cover the unaligned tails */
+	drm_rect_init(&clip, 3, 1, BEADA_TEST_WIDTH - 6, BEADA_TEST_HEIGHT - 2);
+	len = drm_rect_width(&clip) * drm_rect_height(&clip) * sizeof(u16);
+
+	src = kmalloc_array(BEADA_TEST_WIDTH * BEADA_TEST_HEIGHT, sizeof(u32), GFP_KERNEL);
+	ref = kmalloc(len, GFP_KERNEL);
+	out = kmalloc(len, GFP_KERNEL);
+	if (!src || !ref || !out)
+		goto out_free;
+
+	for (i = 0; i < BEADA_TEST_WIDTH * BEADA_TEST_HEIGHT; i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = seed;
+	}
+
+	drm_fb_xrgb8888_to_rgb565(ref, src, &fb, &clip, false);
+	if (beada_convert_xrgb8888_to_rgb565(out, src, fb.pitches[0], &clip))
+		ok = !memcmp(ref, out, len);
+
+out_free:
+	kfree(out);
+	kfree(ref);
+	kfree(src);
+	return ok;
+}
+
+void beada_convert_init(void)
+{
+#ifdef CONFIG_X86
+	if (boot_cpu_has(X86_FEATURE_XMM2)) {
+		beada_line = beada_line_sse2;
+		beada_line_name = "SSE2";
+	}
+#endif
+#ifdef CONFIG_ARM64
+	if (cpu_have_named_feature(ASIMD)) {
+		beada_line = beada_xrgb8888_to_rgb565_line_neon;
+		beada_line_name = "NEON";
+	}
+#endif
+
+	if (!beada_line)
+		return;
+
+	if (!beada_convert_selftest()) {
+		pr_warn("beada: %s conversion does not match the generic helper, disabled\n",
+			beada_line_name);
+		beada_line = NULL;
+		return;
+	}
+
+	pr_info("beada: using %s XRGB8888 to RGB565 conversion\n", beada_line_name);
+}
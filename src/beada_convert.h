@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * XRGB8888 to RGB565 conversion for the BeadaPanel flush path.
+ */
+
+#ifndef __BEADA_CONVERT_H__
+#define __BEADA_CONVERT_H__
+
+#include <linux/types.h>
+
+struct drm_rect;
+
+void beada_convert_init(void);
+
+/*
+ * Convert a clip of an XRGB8888 buffer into packed RGB565 with the vector
+ * unit. Returns false if no vector implementation is usable, in which case
+ * the caller falls back to drm_fb_xrgb8888_to_rgb565().
+ */
+bool beada_convert_xrgb8888_to_rgb565(void *dst, const void *vaddr,
+				      unsigned int pitch,
+				      const struct drm_rect *clip);
+
+#ifdef CONFIG_ARM64
+void beada_xrgb8888_to_rgb565_line_neon(u16 *dst, const u32 *src,
+					unsigned int pixels);
+#endif
+
+#endif /* __BEADA_CONVERT_H__ */
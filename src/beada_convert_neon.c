@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * NEON XRGB8888 to RGB565 line conversion. This file is built with the
+ * FPU/SIMD flags enabled and must only be called between
+ * kernel_neon_begin() and kernel_neon_end().
+ */
+
+#include <asm/neon-intrinsics.h>
+
+#include "beada_convert.h"
+
+void beada_xrgb8888_to_rgb565_line_neon(u16 *dst, const u32 *src,
+					unsigned int pixels)
+{
+	uint8x16x4_t px;
+	uint16x8_t lo, hi;
+	u32 pix;
+
+	/* 16 pixels at a time, de-interleaved into B, G, R and X lanes */
+	for (; pixels >= 16; pixels -= 16, src += 16, dst += 16) {
+		px = vld4q_u8((const u8 *)src);
+
+		lo = vshll_n_u8(vget_low_u8(px.val[2]), 8);
+		lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(px.val[1]), 8), 5);
+		lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(px.val[0]), 8), 11);
+
+		hi = vshll_n_u8(vget_high_u8(px.val[2]), 8);
+		hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(px.val[1]), 8), 5);
+		hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(px.val[0]), 8), 11);
+
+		vst1q_u16(dst, lo);
+		vst1q_u16(dst + 8, hi);
+	}
+
+	for (; pixels; pixels--) {
+		pix = *src++;
+		*dst++ = ((pix & 0x00F80000) >> 8) |
+			 ((pix & 0x0000FC00) >> 5) |
+			 ((pix & 0x000000F8) >> 3);
+	}
+}
@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Bulk bandwidth scheduler shared by all BeadaPanels on a host. Panels
+ * plugged into the same external hub compete for its upstream link, and
+ * full speed ones behind the same transaction translator for the TT;
+ * without coordination a full screen update on one of them delays
+ * everybody else. A panel on a root hub port has the port to itself.
+ * Each link lets sched_slots panels have a frame on the bus at a time
+ * and hands out further turns by weighted deficit round robin, so every
+ * waiting panel gets a share of the bytes in proportion to its weight.
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/usb.h>
+#include <linux/usb/hcd.h>
+
+#include "beada_sched.h"
+
+#define BEADA_SCHED_QUANTUM	(64 * 1024)
+#define BEADA_SCHED_STALL	HZ
+
+static unsigned int sched_slots = 1;
+module_param(sched_slots, uint, 0644);
+MODULE_PARM_DESC(sched_slots,
+		 "Panels behind one hub that may transfer a frame at once (default 1)");
+
+struct beada_sched_link {
+	struct list_head	node;
+	const void		*key;
+	int			ttport;
+	const char		*kind;
+	struct usb_device	*hub;
+	spinlock_t		lock;
+	struct list_head	clients;
+	struct list_head	waiting;
+	unsigned int		slots_used;
+};
+
+/* all links, and their client lists when adding or removing panels */
+static DEFINE_MUTEX(beada_sched_mutex);
+static LIST_HEAD(beada_sched_links);
+
+/*
+ * A panel that stopped draining its endpoint must not block the others.
+ * Its slot is reclaimed after a while, and its late release ignored.
+ */
+static void beada_sched_expire(struct beada_sched_link *link)
+{
+	struct beada_sched_client *client;
+
+	list_for_each_entry(client, &link->clients, node) {
+		if (client->granted && !client->stalled &&
+		    time_after(jiffies, client->granted_at + BEADA_SCHED_STALL)) {
+			client->stalled = true;
+			link->slots_used--;
+		}
+	}
+}
+
+static void beada_sched_grant_one(struct beada_sched_link *link,
+				  struct beada_sched_client *client)
+{
+	client->granted = true;
+	client->stalled = false;
+	client->granted_at = jiffies;
+	link->slots_used++;
+}
+
+/* give back a client's slot, called with link->lock held */
+static void beada_sched_put(struct beada_sched_link *link, struct beada_sched_client *client)
+{
+	if (!client->stalled)
+		link->slots_used--;
+	client->granted = false;
+	client->stalled = false;
+}
+
+/* hand free slots to waiting clients, called with link->lock held */
+static void beada_sched_grant(struct beada_sched_link *link)
+{
+	unsigned int slots = max(READ_ONCE(sched_slots), 1U);
+	struct beada_sched_client *client;
+
+	beada_sched_expire(link);
+
+	while (link->slots_used < slots && !list_empty(&link->waiting)) {
+		client = list_first_entry(&link->waiting, struct beada_sched_client, wait);
+
+		client->deficit += BEADA_SCHED_QUANTUM * max(client->weight, 1U);
+		if (client->deficit < client->want) {
+			list_move_tail(&client->wait, &link->waiting);
+			continue;
+		}
+
+		client->deficit -= client->want;
+		list_del_init(&client->wait);
+		beada_sched_grant_one(link, client);
+
+		/* the owner's frame lock nests outside link->lock, kick from a worker */
+		queue_work(system_highpri_wq, &client->kick);
+	}
+}
+
+/*
+ * Ask for a turn to send @bytes. Returns true if the client may go ahead
+ * right away; otherwise it waits in line and its kick work runs once it
+ * is granted a turn. Callable from URB completion context.
+ */
+bool beada_sched_request(struct beada_sched_client *client, size_t bytes)
+{
+	struct beada_sched_link *link = client->link;
+	unsigned int slots = max(READ_ONCE(sched_slots), 1U);
+	unsigned long flags;
+	bool granted;
+
+	if (!link)
+		return true;
+
+	spin_lock_irqsave(&link->lock, flags);
+
+	beada_sched_expire(link);
+	if (!client->granted && list_empty(&link->waiting) && link->slots_used < slots)
+		beada_sched_grant_one(link, client);
+
+	granted = client->granted;
+	if (!granted) {
+		if (list_empty(&client->wait)) {
+			client->deficit = 0;
+			client->waits++;
+			list_add_tail(&client->wait, &link->waiting);
+		}
+		client->want = bytes;
+	}
+
+	spin_unlock_irqrestore(&link->lock, flags);
+
+	return granted;
+}
+
+/* give up a granted turn, once the frame is off the bus */
+void beada_sched_release(struct beada_sched_client *client)
+{
+	struct beada_sched_link *link = client->link;
+	unsigned long flags;
+
+	if (!link)
+		return;
+
+	spin_lock_irqsave(&link->lock, flags);
+	if (client->granted) {
+		beada_sched_put(link, client);
+		beada_sched_grant(link);
+	}
+	spin_unlock_irqrestore(&link->lock, flags);
+}
+
+/*
+ * What a panel shares bandwidth through: the transaction translator of a
+ * full speed panel behind a high speed hub, else the external hub it is
+ * plugged into. A multi-TT hub has one translator per port behind the same
+ * usb_tt, so @ttport tells those apart. Root hub ports do not share, so
+ * such a panel is its own link. @hub is the device the link is named after.
+ */
+static const void *beada_sched_key(struct usb_device *udev, struct usb_device **hub,
+				   int *ttport, const char **kind)
+{
+	*ttport = 0;
+
+	if (udev->tt) {
+		*hub = udev->tt->hub;
+		if (udev->tt->multi) {
+			*ttport = udev->ttport;
+			*kind = "tt of port";
+		} else {
+			*kind = "tt of hub";
+		}
+		return udev->tt;
+	}
+
+	if (udev->parent && udev->parent->parent) {
+		*hub = udev->parent;
+		*kind = "hub";
+		return udev->parent;
+	}
+
+	*hub = udev;
+	*kind = "root port of";
+	return udev;
+}
+
+int beada_sched_register(struct beada_sched_client *client, struct usb_device *udev)
+{
+	struct beada_sched_link *link;
+	struct usb_device *hub;
+	unsigned long flags;
+	const char *kind;
+	const void *key;
+	int ttport;
+
+	INIT_LIST_HEAD(&client->wait);
+	client->granted = false;
+	client->stalled = false;
+	client->deficit = 0;
+
+	key = beada_sched_key(udev, &hub, &ttport, &kind);
+
+	mutex_lock(&beada_sched_mutex);
+
+	list_for_each_entry(link, &beada_sched_links, node)
+		if (link->key == key && link->ttport == ttport)
+			goto found;
+
+	link = kzalloc(sizeof(*link), GFP_KERNEL);
+	if (!link) {
+		mutex_unlock(&beada_sched_mutex);
+		return -ENOMEM;
+	}
+	link->key = key;
+	link->ttport = ttport;
+	link->kind = kind;
+	link->hub = usb_get_dev(hub);
+	spin_lock_init(&link->lock);
+	INIT_LIST_HEAD(&link->clients);
+	INIT_LIST_HEAD(&link->waiting);
+	list_add_tail(&link->node, &beada_sched_links);
+
+found:
+	spin_lock_irqsave(&link->lock, flags);
+	list_add_tail(&client->node, &link->clients);
+	spin_unlock_irqrestore(&link->lock, flags);
+	client->link = link;
+
+	mutex_unlock(&beada_sched_mutex);
+
+	return 0;
+}
+
+/*
+ * Leave the link, passing on a turn still held. The owner must not start
+ * new transfers afterwards; completions of ones in flight are fine.
+ */
+void beada_sched_unregister(struct beada_sched_client *client)
+{
+	struct beada_sched_link *link = client->link;
+	unsigned long flags;
+
+	if (!link)
+		return;
+
+	mutex_lock(&beada_sched_mutex);
+
+	spin_lock_irqsave(&link->lock, flags);
+	list_del_init(&client->wait);
+	if (client->granted) {
+		beada_sched_put(link, client);
+		beada_sched_grant(link);
+	}
+	list_del(&client->node);
+	client->link = NULL;
+	spin_unlock_irqrestore(&link->lock, flags);
+
+	if (list_empty(&link->clients)) {
+		list_del(&link->node);
+		usb_put_dev(link->hub);
+		kfree(link);
+	}
+
+	mutex_unlock(&beada_sched_mutex);
+
+	cancel_work_sync(&client->kick);
+}
+
+/* list the panels sharing a client's link */
+void beada_sched_show(struct seq_file *m, struct beada_sched_client *client)
+{
+	struct beada_sched_client *peer;
+	struct beada_sched_link *link;
+	unsigned long flags;
+
+	mutex_lock(&beada_sched_mutex);
+
+	link = client->link;
+	if (!link)
+		goto out_unlock;
+
+	spin_lock_irqsave(&link->lock, flags);
+	if (link->ttport)
+		seq_printf(m, "%s %d of hub", link->kind, link->ttport);
+	else
+		seq_printf(m, "%s", link->kind);
+	seq_printf(m, " %s, %u of %u slots busy\n", dev_name(&link->hub->dev),
+		   link->slots_used, max(READ_ONCE(sched_slots), 1U));
+	list_for_each_entry(peer, &link->clients, node)
+		seq_printf(m, "%c %-16s weight %-3u %-8s waits %lu\n",
+			   peer == client ? '*' : ' ', peer->name, peer->weight,
+			   peer->stalled ? "stalled" :
+			   peer->granted ? "sending" :
+			   !list_empty(&peer->wait) ? "waiting" : "idle",
+			   peer->waits);
+	spin_unlock_irqrestore(&link->lock, flags);
+
+out_unlock:
+	mutex_unlock(&beada_sched_mutex);
+}
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+#ifndef __BEADA_SCHED_H__
+#define __BEADA_SCHED_H__
+
+#include <linux/list.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+struct beada_sched_link;
+struct seq_file;
+struct usb_device;
+
+/*
+ * A panel's membership in the bus scheduler. Panels behind the same
+ * external hub or transaction translator share a link, which lets a
+ * limited number of them transfer a frame at a time and grants turns by
+ * weighted deficit round robin over bytes.
+ * The owner sets name and weight and initializes kick, which runs once
+ * a waiting request is granted.
+ */
+struct beada_sched_client {
+	const char		*name;
+	struct beada_sched_link	*link;
+	struct list_head	node;
+	struct list_head	wait;
+	struct work_struct	kick;
+	unsigned int		weight;
+	size_t			want;
+	size_t			deficit;
+	bool			granted;
+	bool			stalled;
+	unsigned long		granted_at;
+	unsigned long		waits;
+};
+
+int beada_sched_register(struct beada_sched_client *client, struct usb_device *udev);
+void beada_sched_unregister(struct beada_sched_client *client);
+bool beada_sched_request(struct beada_sched_client *client, size_t bytes);
+void beada_sched_release(struct beada_sched_client *client);
+void beada_sched_show(struct seq_file *m, struct beada_sched_client *client);
+
+#endif
@@ -0,0 +1,646 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * KUnit tests for the parts of the driver that need no panel: pixel
+ * conversion and blending, damage planning, the tile diff against the
+ * shadow, PanelLink/StatusLink framing and the model table. beada.c
+ * includes this file at its end when built with BEADA_KUNIT_TEST=y, so
+ * the static helpers can be tested, and the suite runs when beadaDRM
+ * loads.
+ *
+ * The timed cases report ns/pixel and ns/frame of a full screen conversion
+ * for every panel model, to catch conversion regressions.
+ */
+
+#include <linux/device.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+
+#include <kunit/test.h>
+
+#if !IS_ENABLED(CONFIG_KUNIT)
+#error "BEADA_KUNIT_TEST needs a kernel with CONFIG_KUNIT"
+#endif
+
+/* not in every kernel this builds against */
+#ifndef DRM_RECT_INIT
+#define DRM_RECT_INIT(_x, _y, _w, _h) ((struct drm_rect){ \
+	.x1 = (_x), .y1 = (_y), .x2 = (_x) + (_w), .y2 = (_y) + (_h) })
+#endif
+
+#define BEADA_TEST_WIDTH	67
+#define BEADA_TEST_HEIGHT	41
+#define BEADA_TEST_ROUNDS	8
+
+static const struct drm_rect beada_test_clips[] = {
+	DRM_RECT_INIT(0, 0, 1, 1),
+	DRM_RECT_INIT(3, 5, 17, 3),
+	DRM_RECT_INIT(1, 2, 65, 38),
+	DRM_RECT_INIT(63, 0, 4, 41),
+	DRM_RECT_INIT(0, 40, 67, 1),
+	DRM_RECT_INIT(0, 0, 67, 41),
+};
+
+static int beada_test_init(struct kunit *test)
+{
+	struct beada_device *beada;
+	struct device *dev;
+	unsigned int i;
+
+	beada_convert_init();
+
+	beada = kunit_kzalloc(test, sizeof(*beada), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, beada);
+
+	dev = root_device_register("beada_test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dev);
+
+	beada->dev.dev = dev;
+	beada->width = 800;
+	beada->height = 480;
+	spin_lock_init(&beada->frame_lock);
+	beada_tag_cache_init(beada);
+	for (i = 0; i < BEADA_MAX_STRIPES; i++)
+		INIT_WORK(&beada->stripes[i].work, beada_stripe_work);
+
+	test->priv = beada;
+	return 0;
+}
+
+static void beada_test_exit(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+
+	if (beada)
+		root_device_unregister(beada->dev.dev);
+}
+
+static void beada_test_fb(struct drm_framebuffer *fb, u32 format, unsigned int width,
+			  unsigned int height)
+{
+	memset(fb, 0, sizeof(*fb));
+	fb->format = drm_format_info(format);
+	fb->width = width;
+	fb->height = height;
+	fb->pitches[0] = width * fb->format->cpp[0];
+}
+
+/* convert @clip like the flush worker does, in @n stripes */
+static void beada_test_stripes(struct beada_device *beada, void *dst, void *src,
+			       struct drm_framebuffer *fb, const struct drm_rect *clip,
+			       unsigned int n, bool parallel)
+{
+	struct dma_buf_map map;
+	unsigned int i;
+
+	dma_buf_map_set_vaddr(&map, src);
+	beada_stripes_start(beada, dst, &map, fb, clip, n, parallel);
+	for (i = 0; i < n; i++)
+		beada_stripe_wait(beada, i);
+}
+
+/* striped and vector conversion match the DRM helper bit for bit */
+static void beada_test_convert_xrgb8888(struct kunit *test)
+{
+	size_t size = BEADA_TEST_WIDTH * BEADA_TEST_HEIGHT;
+	struct beada_device *beada = test->priv;
+	struct drm_framebuffer fb;
+	struct drm_rect clip;
+	u16 *ref, *dst;
+	unsigned int i, n;
+	u32 *src;
+
+	src = kunit_kmalloc_array(test, size, sizeof(*src), GFP_KERNEL);
+	ref = kunit_kmalloc_array(test, size, sizeof(*ref), GFP_KERNEL);
+	dst = kunit_kmalloc_array(test, size, sizeof(*dst), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ref);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+
+	get_random_bytes(src, size * sizeof(*src));
+	beada_test_fb(&fb, DRM_FORMAT_XRGB8888, BEADA_TEST_WIDTH, BEADA_TEST_HEIGHT);
+
+	for (i = 0; i < ARRAY_SIZE(beada_test_clips); i++) {
+		clip = beada_test_clips[i];
+		size = beada_rect_bytes(&clip);
+
+		drm_fb_xrgb8888_to_rgb565(ref, src, &fb, &clip, false);
+
+		for (n = 1; n <= min(drm_rect_height(&clip), 3); n++) {
+			memset(dst, 0, size);
+			beada_test_stripes(beada, dst, src, &fb, &clip, n, true);
+			KUNIT_EXPECT_EQ_MSG(test, memcmp(dst, ref, size), 0,
+					    "clip %u in %u stripes", i, n);
+		}
+
+		memset(dst, 0, size);
+		if (beada_convert_xrgb8888_to_rgb565(dst, src, fb.pitches[0], &clip))
+			KUNIT_EXPECT_EQ_MSG(test, memcmp(dst, ref, size), 0,
+					    "clip %u with the vector unit", i);
+	}
+}
+
+/* RGB565 framebuffers are copied row by row */
+static void beada_test_convert_rgb565(struct kunit *test)
+{
+	size_t size = BEADA_TEST_WIDTH * BEADA_TEST_HEIGHT;
+	struct beada_device *beada = test->priv;
+	const struct drm_rect *clip;
+	struct drm_framebuffer fb;
+	u16 *src, *dst;
+	unsigned int i;
+	int x, y;
+
+	src = kunit_kmalloc_array(test, size, sizeof(*src), GFP_KERNEL);
+	dst = kunit_kmalloc_array(test, size, sizeof(*dst), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dst);
+
+	get_random_bytes(src, size * sizeof(*src));
+	beada_test_fb(&fb, DRM_FORMAT_RGB565, BEADA_TEST_WIDTH, BEADA_TEST_HEIGHT);
+
+	for (i = 0; i < ARRAY_SIZE(beada_test_clips); i++) {
+		clip = &beada_test_clips[i];
+		beada_test_stripes(beada, dst, src, &fb, clip, 1, false);
+
+		for (y = clip->y1; y < clip->y2; y++)
+			for (x = clip->x1; x < clip->x2; x++)
+				KUNIT_EXPECT_EQ(test, dst[(y - clip->y1) * drm_rect_width(clip) +
+							  x - clip->x1],
+						src[y * BEADA_TEST_WIDTH + x]);
+	}
+}
+
+static void beada_test_blend_pixel(struct kunit *test)
+{
+	/* transparent keeps, opaque replaces */
+	KUNIT_EXPECT_EQ(test, beada_blend_pixel(0x1234, 0x00000000), 0x1234);
+	KUNIT_EXPECT_EQ(test, beada_blend_pixel(0xffff, 0x00000000), 0xffff);
+	KUNIT_EXPECT_EQ(test, beada_blend_pixel(0x1234, 0xffff0000), 0xf800);
+	KUNIT_EXPECT_EQ(test, beada_blend_pixel(0x1234, 0xff00ff00), 0x07e0);
+	KUNIT_EXPECT_EQ(test, beada_blend_pixel(0x1234, 0xff0000ff), 0x001f);
+
+	/* premultiplied half white over black and over white */
+	KUNIT_EXPECT_EQ(test, beada_blend_pixel(0x0000, 0x80808080), 0x8410);
+	KUNIT_EXPECT_EQ(test, beada_blend_pixel(0xffff, 0x80808080), 0xffff);
+}
+
+static void beada_test_damage_add(struct kunit *test)
+{
+	struct beada_damage damage = { .num_clips = 0 };
+	struct drm_rect clip, bbox;
+	unsigned int i;
+
+	clip = DRM_RECT_INIT(10, 10, 20, 20);
+	beada_damage_add(&damage, &clip);
+	clip = DRM_RECT_INIT(12, 12, 4, 4);
+	beada_damage_add(&damage, &clip);
+	KUNIT_EXPECT_EQ(test, damage.num_clips, 1);
+
+	/* one clip too many collapses the damage to its bounding box */
+	for (i = 1; i <= BEADA_MAX_CLIPS; i++) {
+		clip = DRM_RECT_INIT(100 * i, 0, 10, 10);
+		beada_damage_add(&damage, &clip);
+	}
+	bbox = DRM_RECT_INIT(10, 0, 100 * BEADA_MAX_CLIPS, 30);
+	KUNIT_EXPECT_EQ(test, damage.num_clips, 1);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&damage.clips[0], &bbox));
+}
+
+static void beada_test_set_sent(struct beada_device *beada, const struct drm_rect *rect)
+{
+	beada->old_rect_x1 = rect->x1;
+	beada->old_rect_y1 = rect->y1;
+	beada->old_rect_x2 = rect->x2;
+	beada->old_rect_y2 = rect->y2;
+}
+
+static void beada_test_rect_sent(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	struct drm_rect rect = DRM_RECT_INIT(0, 0, 800, 480);
+
+	KUNIT_EXPECT_FALSE(test, beada_rect_sent(beada, &rect));
+	beada_test_set_sent(beada, &rect);
+	KUNIT_EXPECT_TRUE(test, beada_rect_sent(beada, &rect));
+
+	/* same size elsewhere is a new geometry */
+	rect = DRM_RECT_INIT(1, 0, 800, 480);
+	KUNIT_EXPECT_FALSE(test, beada_rect_sent(beada, &rect));
+}
+
+static void beada_test_damage_plan(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	unsigned int saved_tag_cost = tag_cost;
+	struct beada_damage damage, plan;
+	struct drm_rect rect;
+
+	damage.clips[0] = DRM_RECT_INIT(0, 0, 10, 10);
+	damage.clips[1] = DRM_RECT_INIT(700, 400, 10, 10);
+	damage.num_clips = 2;
+
+	/* cheap tags keep far apart clips apart */
+	tag_cost = 1;
+	beada_damage_plan(beada, &damage, &plan);
+	KUNIT_EXPECT_EQ(test, plan.num_clips, 2);
+
+	/* expensive tags merge them into their bounding box */
+	tag_cost = 1000000;
+	beada_damage_plan(beada, &damage, &plan);
+	rect = DRM_RECT_INIT(0, 0, 710, 410);
+	KUNIT_EXPECT_EQ(test, plan.num_clips, 1);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&plan.clips[0], &rect));
+
+	/* or send the rect the panel already has a tag for, if it covers them */
+	rect = DRM_RECT_INIT(0, 0, 800, 480);
+	beada_test_set_sent(beada, &rect);
+	beada_damage_plan(beada, &damage, &plan);
+	KUNIT_EXPECT_EQ(test, plan.num_clips, 1);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&plan.clips[0], &rect));
+
+	/* a clip matching the last tag goes out unchanged */
+	damage.clips[0] = DRM_RECT_INIT(100, 100, 50, 50);
+	damage.num_clips = 1;
+	beada_test_set_sent(beada, &damage.clips[0]);
+	beada_damage_plan(beada, &damage, &plan);
+	KUNIT_EXPECT_EQ(test, plan.num_clips, 1);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&plan.clips[0], &damage.clips[0]));
+
+	/* overlapping clips that do not fit the frame one by one are merged */
+	tag_cost = 1;
+	damage.clips[0] = DRM_RECT_INIT(0, 0, 800, 300);
+	damage.clips[1] = DRM_RECT_INIT(0, 100, 800, 380);
+	damage.num_clips = 2;
+	beada_damage_plan(beada, &damage, &plan);
+	KUNIT_EXPECT_EQ(test, plan.num_clips, 1);
+
+	tag_cost = saved_tag_cost;
+}
+
+static void beada_test_shadow_alloc(struct kunit *test, struct beada_device *beada)
+{
+	size_t size = beada->width * beada->height * RGB565_BPP / 8;
+
+	beada->shadow = kunit_kzalloc(test, size, GFP_KERNEL);
+	beada->conv_buf = kunit_kzalloc(test, size, GFP_KERNEL);
+	beada->bands = kunit_kcalloc(test, DIV_ROUND_UP(beada->height, BEADA_TILE_SIZE),
+				     sizeof(*beada->bands), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, beada->shadow);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, beada->conv_buf);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, beada->bands);
+}
+
+static void beada_test_shadow_diff(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	struct beada_damage changed;
+	struct drm_rect clip, rect;
+	u16 *conv;
+
+	beada->width = 64;
+	beada->height = 48;
+	beada_test_shadow_alloc(test, beada);
+	conv = (u16 *)beada->conv_buf;
+	clip = DRM_RECT_INIT(0, 0, 64, 48);
+
+	changed.num_clips = 0;
+	beada_shadow_diff(beada, &clip, &changed);
+	KUNIT_EXPECT_EQ(test, changed.num_clips, 0);
+
+	/* one pixel resends its tile, once */
+	conv[5 * 64 + 20] = 0xffff;
+	changed.num_clips = 0;
+	beada_shadow_diff(beada, &clip, &changed);
+	rect = DRM_RECT_INIT(16, 0, 16, 16);
+	KUNIT_ASSERT_EQ(test, changed.num_clips, 1);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&changed.clips[0], &rect));
+
+	changed.num_clips = 0;
+	beada_shadow_diff(beada, &clip, &changed);
+	KUNIT_EXPECT_EQ(test, changed.num_clips, 0);
+
+	/* the same tiles changing in the next tile row extend the rect down */
+	conv[5 * 64 + 20] = 0;
+	conv[20 * 64 + 20] = 0xffff;
+	changed.num_clips = 0;
+	beada_shadow_diff(beada, &clip, &changed);
+	rect = DRM_RECT_INIT(16, 0, 16, 32);
+	KUNIT_ASSERT_EQ(test, changed.num_clips, 1);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&changed.clips[0], &rect));
+
+	/* neighbouring tiles in a row form one run, other columns a new rect */
+	conv[20 * 64 + 20] = 0;
+	conv[20 * 64 + 40] = 0xffff;
+	conv[40 * 64 + 0] = 0xffff;
+	changed.num_clips = 0;
+	beada_shadow_diff(beada, &clip, &changed);
+	KUNIT_ASSERT_EQ(test, changed.num_clips, 2);
+	rect = DRM_RECT_INIT(16, 16, 32, 16);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&changed.clips[0], &rect));
+	rect = DRM_RECT_INIT(0, 32, 16, 16);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&changed.clips[1], &rect));
+
+	/* the shadow now holds exactly what was converted */
+	KUNIT_EXPECT_EQ(test, memcmp(beada->shadow, beada->conv_buf, 64 * 48 * 2), 0);
+}
+
+/* a clip off the tile grid only reports the part of its tiles it covers */
+static void beada_test_shadow_diff_unaligned(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	struct beada_damage changed = { .num_clips = 0 };
+	struct drm_rect clip, rect;
+	u16 *conv;
+
+	beada->width = 64;
+	beada->height = 48;
+	beada_test_shadow_alloc(test, beada);
+	conv = (u16 *)beada->conv_buf;
+
+	clip = DRM_RECT_INIT(10, 7, 13, 5);
+	conv[2 * 13 + 12] = 0x1234;
+	beada_shadow_diff(beada, &clip, &changed);
+	rect = DRM_RECT_INIT(16, 7, 7, 5);
+	KUNIT_ASSERT_EQ(test, changed.num_clips, 1);
+	KUNIT_EXPECT_TRUE(test, drm_rect_equals(&changed.clips[0], &rect));
+	KUNIT_EXPECT_EQ(test, ((u16 *)beada->shadow)[9 * 64 + 22], 0x1234);
+}
+
+/* ones' complement sum over a message including its checksum */
+static u16 beada_test_csum(const void *buf, size_t len)
+{
+	const u16 *w = buf;
+	unsigned long sum = 0;
+
+	for (; len >= 2; len -= 2)
+		sum += *w++;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+
+	return sum;
+}
+
+static void beada_test_pl_tag(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	struct beada_tag *tag;
+	char fmt[256];
+
+	tag = beada_tag_lookup(beada, 1280, 480, DRM_FORMAT_RGB565);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, tag);
+
+	/* name, version, type, format string, checksum */
+	KUNIT_EXPECT_EQ(test, tag->len, 270);
+	KUNIT_EXPECT_EQ(test, memcmp(tag->buf, "PANEL-LINK", 10), 0);
+	KUNIT_EXPECT_EQ(test, tag->buf[10], 1);
+	KUNIT_EXPECT_EQ(test, tag->buf[11], 1);
+	snprintf(fmt, sizeof(fmt), "video/x-raw, format=RGB16, height=%d, width=%d, framerate=0/1",
+		 480, 1280);
+	KUNIT_EXPECT_STREQ(test, (char *)tag->buf + 12, fmt);
+	KUNIT_EXPECT_EQ(test, beada_test_csum(tag->buf, tag->len), 0xffff);
+}
+
+static void beada_test_pl_tag_cache(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	struct beada_tag *tag;
+	int i;
+
+	tag = beada_tag_lookup(beada, 64, 64, DRM_FORMAT_RGB565);
+	KUNIT_EXPECT_PTR_EQ(test, beada_tag_lookup(beada, 64, 64, DRM_FORMAT_RGB565), tag);
+	KUNIT_EXPECT_EQ(test, beada->stats.tag_misses, 1);
+	KUNIT_EXPECT_EQ(test, beada->stats.tag_hits, 1);
+
+	/* the least recently used geometry makes room for new ones */
+	for (i = 1; i <= BEADA_TAG_CACHE; i++)
+		beada_tag_lookup(beada, i, i, DRM_FORMAT_RGB565);
+	beada_tag_lookup(beada, 64, 64, DRM_FORMAT_RGB565);
+	KUNIT_EXPECT_EQ(test, beada->stats.tag_misses, BEADA_TAG_CACHE + 2);
+}
+
+static void beada_test_sl_get_info(struct kunit *test)
+{
+	unsigned char buf[CMD_SIZE];
+	unsigned int len = sizeof(buf);
+
+	KUNIT_ASSERT_EQ(test, fillSLGetInfo(buf, &len), 0);
+	KUNIT_EXPECT_EQ(test, len, 20);
+	KUNIT_EXPECT_EQ(test, memcmp(buf, "STATUS-LINK", 11), 0);
+	KUNIT_EXPECT_EQ(test, buf[12], 1);
+	KUNIT_EXPECT_EQ(test, beada_test_csum(buf, len), 0xffff);
+
+	/* too small a buffer is refused */
+	len = 19;
+	KUNIT_EXPECT_NE(test, fillSLGetInfo(buf, &len), 0);
+}
+
+static void beada_test_sl_info_parse(struct kunit *test)
+{
+	unsigned char buf[CMD_SIZE] = { 0 };
+	STATUSLINK_INFO reply = { 0 }, info;
+	unsigned int len = 20 + sizeof(reply);
+
+	KUNIT_EXPECT_EQ(test, sizeof(STATUSLINK_INFO), 80);
+
+	reply.os_version = MODEL_6S;
+	reply.screen_resolution_x = 1280;
+	reply.screen_resolution_y = 480;
+	reply.max_brightness = 100;
+	memcpy(buf + 20, &reply, sizeof(reply));
+
+	KUNIT_ASSERT_EQ(test, retrivSLGetInfo(buf, len, &info), 0);
+	KUNIT_EXPECT_EQ(test, info.os_version, MODEL_6S);
+	KUNIT_EXPECT_EQ(test, info.screen_resolution_x, 1280);
+	KUNIT_EXPECT_EQ(test, info.screen_resolution_y, 480);
+	KUNIT_EXPECT_EQ(test, info.max_brightness, 100);
+
+	/* short reads are refused */
+	KUNIT_EXPECT_NE(test, retrivSLGetInfo(buf, len - 1, &info), 0);
+	KUNIT_EXPECT_NE(test, retrivSLGetInfo(buf, 20, &info), 0);
+	KUNIT_EXPECT_NE(test, retrivSLGetInfo(buf, 0, &info), 0);
+}
+
+static void beada_test_models(struct kunit *test)
+{
+	const struct beada_model *model;
+
+	model = beada_model_find(MODEL_6C);
+	KUNIT_EXPECT_STREQ(test, model->name, "6C");
+	KUNIT_EXPECT_EQ(test, model->width, 1280);
+	KUNIT_EXPECT_EQ(test, model->height, 480);
+
+	model = beada_model_find(MODEL_2);
+	KUNIT_EXPECT_EQ(test, model->width, 480);
+	KUNIT_EXPECT_EQ(test, model->height, 480);
+
+	/* unknown panels are driven like a Model 5 */
+	model = beada_model_find(0xff);
+	KUNIT_EXPECT_STREQ(test, model->name, "5");
+
+	/* the id table the driver binds with */
+	KUNIT_EXPECT_EQ(test, beada_usb_driver.id_table[0].idVendor, 0x4e58);
+	KUNIT_EXPECT_EQ(test, beada_usb_driver.id_table[0].idProduct, 0x1001);
+}
+
+/* ns for @rounds full screen conversions, striped as the flush worker does */
+static u64 beada_test_time_convert(struct beada_device *beada, u16 *dst, u32 *src,
+				   struct drm_framebuffer *fb, bool striped)
+{
+	struct drm_rect clip = DRM_RECT_INIT(0, 0, fb->width, fb->height);
+	u64 start = ktime_get_ns();
+	unsigned int i;
+
+	for (i = 0; i < BEADA_TEST_ROUNDS; i++) {
+		if (striped)
+			beada_test_stripes(beada, dst, src, fb, &clip,
+					   beada_stripes_count(&clip), true);
+		else
+			drm_fb_xrgb8888_to_rgb565(dst, src, fb, &clip, false);
+	}
+
+	return ktime_get_ns() - start;
+}
+
+static void beada_test_timing(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	const struct beada_model *model;
+	struct drm_framebuffer fb;
+	u64 pixels, helper, ns;
+	unsigned int i;
+	u16 *dst;
+	u32 *src;
+
+	src = vmalloc(1280 * 480 * sizeof(*src));
+	dst = vmalloc(1280 * 480 * sizeof(*dst));
+	if (!src || !dst) {
+		vfree(src);
+		vfree(dst);
+		kunit_skip(test, "no memory for a full screen");
+	}
+	get_random_bytes(src, 1280 * 480 * sizeof(*src));
+
+	for (i = 0; i < ARRAY_SIZE(beada_models); i++) {
+		model = &beada_models[i];
+		beada_test_fb(&fb, DRM_FORMAT_XRGB8888, model->width, model->height);
+		pixels = (u64)model->width * model->height * BEADA_TEST_ROUNDS;
+
+		helper = beada_test_time_convert(beada, dst, src, &fb, false);
+		ns = beada_test_time_convert(beada, dst, src, &fb, true);
+
+		kunit_info(test, "Model %-2s %4dx%-3d %3llu.%02llu ns/pixel %8llu ns/frame (helper %3llu.%02llu ns/pixel)\n",
+			   model->name, model->width, model->height,
+			   div64_u64(ns, pixels), div64_u64(ns * 100, pixels) % 100,
+			   div64_u64(ns, BEADA_TEST_ROUNDS),
+			   div64_u64(helper, pixels), div64_u64(helper * 100, pixels) % 100);
+	}
+
+	vfree(src);
+	vfree(dst);
+}
+
+/* ns for a full screen diff, every tile changed each round or none */
+static u64 beada_test_time_diff(struct beada_device *beada, const struct drm_rect *clip,
+				bool change)
+{
+	size_t size = beada_rect_bytes(clip);
+	struct beada_damage changed;
+	u64 ns = 0, start;
+	unsigned int i, j;
+
+	for (i = 0; i < BEADA_TEST_ROUNDS; i++) {
+		if (change)
+			for (j = 0; j < size; j += BEADA_TILE_SIZE * RGB565_BPP / 8)
+				beada->conv_buf[j] ^= 0xff;
+
+		changed.num_clips = 0;
+		start = ktime_get_ns();
+		beada_shadow_diff(beada, clip, &changed);
+		ns += ktime_get_ns() - start;
+	}
+
+	return div64_u64(ns, BEADA_TEST_ROUNDS);
+}
+
+static void beada_test_diff_timing(struct kunit *test)
+{
+	struct beada_device *beada = test->priv;
+	bool saved_band_hash = band_hash;
+	struct drm_rect clip;
+	u64 same, all;
+	size_t size;
+	int hash;
+
+	drm_rect_init(&clip, 0, 0, beada->width, beada->height);
+	size = beada_rect_bytes(&clip);
+	beada->bands = kunit_kcalloc(test, DIV_ROUND_UP(beada->height, BEADA_TILE_SIZE),
+				     sizeof(*beada->bands), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, beada->bands);
+	beada->shadow = vmalloc(size);
+	beada->conv_buf = vmalloc(size);
+	if (!beada->shadow || !beada->conv_buf) {
+		vfree(beada->shadow);
+		vfree(beada->conv_buf);
+		kunit_skip(test, "no memory for a full screen");
+	}
+	get_random_bytes(beada->conv_buf, size);
+	memcpy(beada->shadow, beada->conv_buf, size);
+
+	for (hash = 0; hash <= 1; hash++) {
+		band_hash = hash;
+		memset(beada->bands, 0, DIV_ROUND_UP(beada->height, BEADA_TILE_SIZE) *
+		       sizeof(*beada->bands));
+		beada_test_time_diff(beada, &clip, false);
+
+		same = beada_test_time_diff(beada, &clip, false);
+		all = beada_test_time_diff(beada, &clip, true);
+		kunit_info(test, "diff %dx%d band_hash %d: %llu ns unchanged, %llu ns all changed\n",
+			   beada->width, beada->height, hash, same, all);
+	}
+
+	band_hash = saved_band_hash;
+	vfree(beada->shadow);
+	vfree(beada->conv_buf);
+}
+
+static struct kunit_case beada_test_cases[] = {
+	KUNIT_CASE(beada_test_convert_xrgb8888),
+	KUNIT_CASE(beada_test_convert_rgb565),
+	KUNIT_CASE(beada_test_blend_pixel),
+	KUNIT_CASE(beada_test_damage_add),
+	KUNIT_CASE(beada_test_rect_sent),
+	KUNIT_CASE(beada_test_damage_plan),
+	KUNIT_CASE(beada_test_shadow_diff),
+	KUNIT_CASE(beada_test_shadow_diff_unaligned),
+	KUNIT_CASE(beada_test_pl_tag),
+	KUNIT_CASE(beada_test_pl_tag_cache),
+	KUNIT_CASE(beada_test_sl_get_info),
+	KUNIT_CASE(beada_test_sl_info_parse),
+	KUNIT_CASE(beada_test_models),
+	KUNIT_CASE(beada_test_timing),
+	KUNIT_CASE(beada_test_diff_timing),
+	{}
+};
+
+static struct kunit_suite beada_test_suite = {
+	.name = "beada",
+	.init = beada_test_init,
+	.exit = beada_test_exit,
+	.test_cases = beada_test_cases,
+};
+
+/*
+ * Up to 5.17, kunit_test_suite() in a module brings a module_init() of its
+ * own, so beada_init() runs the suite instead.
+ */
+static struct kunit_suite *beada_test_suites[] = { &beada_test_suite, NULL };
+
+static int beada_test_run(void)
+{
+	return __kunit_test_suites_init(beada_test_suites);
+}
+
+static void beada_test_release(void)
+{
+	__kunit_test_suites_exit(beada_test_suites);
+}
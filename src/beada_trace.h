@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Tracepoints along the frame pipeline: damage from the atomic commit,
+ * conversion, PanelLink tags, bulk transfers and frames that never made
+ * it to the panel. Frame events carry a sequence number, so a trace can be
+ * broken down into per-frame latencies.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM beada
+
+#if !defined(_BEADA_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _BEADA_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+#include <drm/drm_rect.h>
+
+DECLARE_EVENT_CLASS(beada_rect,
+	TP_PROTO(const struct device *dev, const struct drm_rect *rect, size_t bytes),
+	TP_ARGS(dev, rect, bytes),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(int, x1)
+		__field(int, y1)
+		__field(int, x2)
+		__field(int, y2)
+		__field(size_t, bytes)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->x1 = rect->x1;
+		__entry->y1 = rect->y1;
+		__entry->x2 = rect->x2;
+		__entry->y2 = rect->y2;
+		__entry->bytes = bytes;
+	),
+	TP_printk("%s rect=%d,%d-%d,%d bytes=%zu", __get_str(dev),
+		  __entry->x1, __entry->y1, __entry->x2, __entry->y2, __entry->bytes)
+);
+
+DEFINE_EVENT(beada_rect, beada_damage,
+	TP_PROTO(const struct device *dev, const struct drm_rect *rect, size_t bytes),
+	TP_ARGS(dev, rect, bytes)
+);
+
+DEFINE_EVENT(beada_rect, beada_convert_start,
+	TP_PROTO(const struct device *dev, const struct drm_rect *rect, size_t bytes),
+	TP_ARGS(dev, rect, bytes)
+);
+
+DEFINE_EVENT(beada_rect, beada_convert_end,
+	TP_PROTO(const struct device *dev, const struct drm_rect *rect, size_t bytes),
+	TP_ARGS(dev, rect, bytes)
+);
+
+/* damage of a commit merged into one the flush worker has not taken yet */
+DEFINE_EVENT(beada_rect, beada_commit_coalesced,
+	TP_PROTO(const struct device *dev, const struct drm_rect *rect, size_t bytes),
+	TP_ARGS(dev, rect, bytes)
+);
+
+TRACE_EVENT(beada_tag_send,
+	TP_PROTO(const struct device *dev, unsigned int seq, const struct drm_rect *rect,
+		 unsigned int len),
+	TP_ARGS(dev, seq, rect, len),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, seq)
+		__field(int, x1)
+		__field(int, y1)
+		__field(int, x2)
+		__field(int, y2)
+		__field(unsigned int, len)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->seq = seq;
+		__entry->x1 = rect->x1;
+		__entry->y1 = rect->y1;
+		__entry->x2 = rect->x2;
+		__entry->y2 = rect->y2;
+		__entry->len = len;
+	),
+	TP_printk("%s seq=%u rect=%d,%d-%d,%d len=%u", __get_str(dev), __entry->seq,
+		  __entry->x1, __entry->y1, __entry->x2, __entry->y2, __entry->len)
+);
+
+TRACE_EVENT(beada_urb_submit,
+	TP_PROTO(const struct device *dev, unsigned int seq, const struct urb *urb),
+	TP_ARGS(dev, seq, urb),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, seq)
+		__field(const void *, urb)
+		__field(u32, len)
+		__field(int, num_sgs)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->seq = seq;
+		__entry->urb = urb;
+		__entry->len = urb->transfer_buffer_length;
+		__entry->num_sgs = urb->num_sgs;
+	),
+	TP_printk("%s seq=%u urb=%p len=%u sgs=%d", __get_str(dev), __entry->seq,
+		  __entry->urb, __entry->len, __entry->num_sgs)
+);
+
+TRACE_EVENT(beada_urb_complete,
+	TP_PROTO(const struct device *dev, unsigned int seq, const struct urb *urb),
+	TP_ARGS(dev, seq, urb),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, seq)
+		__field(const void *, urb)
+		__field(u32, actual)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->seq = seq;
+		__entry->urb = urb;
+		__entry->actual = urb->actual_length;
+		__entry->status = urb->status;
+	),
+	TP_printk("%s seq=%u urb=%p actual=%u status=%d", __get_str(dev), __entry->seq,
+		  __entry->urb, __entry->actual, __entry->status)
+);
+
+DECLARE_EVENT_CLASS(beada_frame,
+	TP_PROTO(const struct device *dev, unsigned int seq, unsigned int num_clips,
+		 size_t bytes),
+	TP_ARGS(dev, seq, num_clips, bytes),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned int, seq)
+		__field(unsigned int, num_clips)
+		__field(size_t, bytes)
+	),
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->seq = seq;
+		__entry->num_clips = num_clips;
+		__entry->bytes = bytes;
+	),
+	TP_printk("%s seq=%u clips=%u bytes=%zu", __get_str(dev), __entry->seq,
+		  __entry->num_clips, __entry->bytes)
+);
+
+/* converted frame handed to the bus or the mailbox */
+DEFINE_EVENT(beada_frame, beada_frame_queue,
+	TP_PROTO(const struct device *dev, unsigned int seq, unsigned int num_clips,
+		 size_t bytes),
+	TP_ARGS(dev, seq, num_clips, bytes)
+);
+
+/* frame replaced in the mailbox by a newer one before reaching the bus */
+DEFINE_EVENT(beada_frame, beada_frame_drop,
+	TP_PROTO(const struct device *dev, unsigned int seq, unsigned int num_clips,
+		 size_t bytes),
+	TP_ARGS(dev, seq, num_clips, bytes)
+);
+
+/* last transfer of a frame completed */
+DEFINE_EVENT(beada_frame, beada_frame_done,
+	TP_PROTO(const struct device *dev, unsigned int seq, unsigned int num_clips,
+		 size_t bytes),
+	TP_ARGS(dev, seq, num_clips, bytes)
+);
+
+#endif /* _BEADA_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE beada_trace
+#include <trace/define_trace.h>
@@ -18,7 +18,11 @@
  *
  */
 
+#ifdef __KERNEL__
 #include <linux/module.h>
+#else
+#include <string.h>
+#endif
 #include "panelLinkProtocol.h"
 
 #define LOGW(fmt, ...) do {;} while(0)
@@ -19,7 +19,11 @@
  *
  */
 
+#ifdef __KERNEL__
 #include <linux/module.h>
+#else
+#include <string.h>
+#endif
 #include "statusLinkProtocol.h"
 
 #define LOGW(fmt, ...) do {;} while(0)
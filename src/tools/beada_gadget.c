@@ -0,0 +1,622 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * BeadaPanel emulator on top of raw-gadget, so the driver can be run and
+ * measured without a panel. With dummy_hcd the emulated panel shows up on
+ * the same machine:
+ *   modprobe dummy_hcd; modprobe raw_gadget
+ *   make -C src gadget && sudo src/user/beada_gadget -m 16
+ *
+ * It enumerates as 4e58:1001 with the panel's endpoints, answers StatusLink
+ * GetInfo with the given os_version, follows PanelLink start tags on
+ * endpoint 1 and reports what arrives:
+ *   uploads/s  rects received, one per clip the driver sends
+ *   full/s     uploads covering the whole screen, the panel's frame rate
+ *              for full screen updates
+ *   MB/s, bytes/upload, tags/s
+ *
+ * Run tools/beada_load next to it to generate damage.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "../statusLinkProtocol.h"
+
+#define GADGET_VID		0x4e58
+#define GADGET_PID		0x1001
+
+#define EP_DATA			1	/* PanelLink tags and pixels, OUT */
+#define EP_MISC			2	/* StatusLink, OUT and IN */
+#define EP_MAXPACKET		512
+
+#define PL_NAME			"PANEL-LINK"
+#define PL_NAME_LEN		10
+#define PL_TAG_LEN		270	/* name, version, type, format string, checksum */
+#define PL_TYPE_START		1
+#define PL_TYPE_END		2
+#define PL_TYPE_RESET		3
+
+#define SL_NAME			"STATUS-LINK"
+#define SL_NAME_LEN		11
+#define SL_TAG_LEN		20
+#define SL_TYPE_GET_INFO	1
+
+#define DATA_READ_SIZE		(64 * 1024)
+#define MISC_READ_SIZE		512
+#define EP0_SIZE		256
+
+struct gadget_event {
+	__u32			type;
+	__u32			length;
+	struct usb_ctrlrequest	ctrl;
+};
+
+struct gadget_io {
+	__u16	ep;
+	__u16	flags;
+	__u32	length;
+	__u8	data[DATA_READ_SIZE];
+};
+
+struct gadget_stats {
+	unsigned long long	uploads;
+	unsigned long long	full;
+	unsigned long long	pixel_bytes;
+	unsigned long long	tags;
+	unsigned long long	other_tags;
+	unsigned long long	junk_bytes;
+	unsigned long long	status_msgs;
+};
+
+/* the PanelLink stream on endpoint 1: start tags, then rects of pixels */
+struct gadget_parser {
+	unsigned char		tag[PL_TAG_LEN];
+	unsigned int		tag_len;
+	unsigned long long	need;
+	int			width;
+	int			height;
+};
+
+static int fd;
+static int os_version;
+static int width = 800, height = 480;
+static int ep_data_handle = -1, ep_misc_out_handle = -1, ep_misc_in_handle = -1;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct gadget_stats stats;
+static int cur_width, cur_height;
+
+static const struct usb_device_descriptor device_desc = {
+	.bLength		= USB_DT_DEVICE_SIZE,
+	.bDescriptorType	= USB_DT_DEVICE,
+	.bcdUSB			= __constant_cpu_to_le16(0x0200),
+	.bMaxPacketSize0	= 64,
+	.idVendor		= __constant_cpu_to_le16(GADGET_VID),
+	.idProduct		= __constant_cpu_to_le16(GADGET_PID),
+	.iManufacturer		= 1,
+	.iProduct		= 2,
+	.bNumConfigurations	= 1,
+};
+
+static const struct usb_qualifier_descriptor qualifier_desc = {
+	.bLength		= sizeof(struct usb_qualifier_descriptor),
+	.bDescriptorType	= USB_DT_DEVICE_QUALIFIER,
+	.bcdUSB			= __constant_cpu_to_le16(0x0200),
+	.bMaxPacketSize0	= 64,
+	.bNumConfigurations	= 1,
+};
+
+static struct usb_endpoint_descriptor ep_descs[] = {
+	{
+		.bLength		= USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType	= USB_DT_ENDPOINT,
+		.bEndpointAddress	= USB_DIR_OUT | EP_DATA,
+		.bmAttributes		= USB_ENDPOINT_XFER_BULK,
+		.wMaxPacketSize		= __constant_cpu_to_le16(EP_MAXPACKET),
+	},
+	{
+		.bLength		= USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType	= USB_DT_ENDPOINT,
+		.bEndpointAddress	= USB_DIR_OUT | EP_MISC,
+		.bmAttributes		= USB_ENDPOINT_XFER_BULK,
+		.wMaxPacketSize		= __constant_cpu_to_le16(EP_MAXPACKET),
+	},
+	{
+		.bLength		= USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType	= USB_DT_ENDPOINT,
+		.bEndpointAddress	= USB_DIR_IN | EP_MISC,
+		.bmAttributes		= USB_ENDPOINT_XFER_BULK,
+		.wMaxPacketSize		= __constant_cpu_to_le16(EP_MAXPACKET),
+	},
+};
+
+static const char *const strings[] = { NULL, "BeadaPanel emulator", "BeadaPanel" };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(EXIT_FAILURE);
+}
+
+/* ones' complement sum of a message including its checksum, 0xffff if intact */
+static unsigned int csum(const unsigned char *buf, unsigned int len)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += buf[i] | buf[i + 1] << 8;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+
+	return sum & 0xffff;
+}
+
+static int config_desc(unsigned char *buf)
+{
+	struct usb_config_descriptor config = {
+		.bLength		= USB_DT_CONFIG_SIZE,
+		.bDescriptorType	= USB_DT_CONFIG,
+		.bNumInterfaces		= 1,
+		.bConfigurationValue	= 1,
+		.bmAttributes		= USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_SELFPOWER,
+		.bMaxPower		= 50,
+	};
+	struct usb_interface_descriptor intf = {
+		.bLength		= USB_DT_INTERFACE_SIZE,
+		.bDescriptorType	= USB_DT_INTERFACE,
+		.bNumEndpoints		= sizeof(ep_descs) / sizeof(ep_descs[0]),
+		.bInterfaceClass	= USB_CLASS_VENDOR_SPEC,
+	};
+	unsigned int i;
+	int len;
+
+	len = USB_DT_CONFIG_SIZE;
+	memcpy(buf + len, &intf, USB_DT_INTERFACE_SIZE);
+	len += USB_DT_INTERFACE_SIZE;
+	for (i = 0; i < sizeof(ep_descs) / sizeof(ep_descs[0]); i++) {
+		memcpy(buf + len, &ep_descs[i], USB_DT_ENDPOINT_SIZE);
+		len += USB_DT_ENDPOINT_SIZE;
+	}
+
+	config.wTotalLength = htole16(len);
+	memcpy(buf, &config, USB_DT_CONFIG_SIZE);
+
+	return len;
+}
+
+static int string_desc(unsigned char *buf, unsigned int index)
+{
+	const char *s;
+	int len = 2;
+
+	if (!index) {
+		buf[len++] = 0x09;	/* English (US) */
+		buf[len++] = 0x04;
+	} else if (index < sizeof(strings) / sizeof(strings[0])) {
+		for (s = strings[index]; *s; s++) {
+			buf[len++] = *s;
+			buf[len++] = 0;
+		}
+	} else {
+		return -1;
+	}
+
+	buf[0] = len;
+	buf[1] = USB_DT_STRING;
+
+	return len;
+}
+
+static void upload_done(struct gadget_parser *p)
+{
+	pthread_mutex_lock(&stats_lock);
+	stats.uploads++;
+	if (p->width == width && p->height == height)
+		stats.full++;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void parse_tag(struct gadget_parser *p)
+{
+	int w, h;
+
+	pthread_mutex_lock(&stats_lock);
+	if (p->tag[PL_NAME_LEN + 1] == PL_TYPE_START &&
+	    sscanf((char *)p->tag + PL_NAME_LEN + 2,
+		   "video/x-raw, format=RGB16, height=%d, width=%d", &h, &w) == 2 &&
+	    w > 0 && h > 0) {
+		p->width = w;
+		p->height = h;
+		cur_width = w;
+		cur_height = h;
+		stats.tags++;
+	} else {
+		stats.other_tags++;
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void parse(struct gadget_parser *p, const unsigned char *buf, size_t len)
+{
+	unsigned char pixels[PL_TAG_LEN];
+	unsigned int n;
+
+	while (len) {
+		if (p->need) {
+			n = len < p->need ? len : p->need;
+			p->need -= n;
+			buf += n;
+			len -= n;
+			pthread_mutex_lock(&stats_lock);
+			stats.pixel_bytes += n;
+			pthread_mutex_unlock(&stats_lock);
+			if (!p->need)
+				upload_done(p);
+			continue;
+		}
+
+		/* between rects: a start tag, or the next rect of the same size */
+		p->tag[p->tag_len++] = *buf++;
+		len--;
+
+		if (p->tag_len <= PL_NAME_LEN && p->tag[p->tag_len - 1] == PL_NAME[p->tag_len - 1])
+			continue;
+		if (p->tag_len > PL_NAME_LEN && p->tag_len < PL_TAG_LEN)
+			continue;
+		if (p->tag_len == PL_TAG_LEN && csum(p->tag, PL_TAG_LEN) == 0xffff) {
+			parse_tag(p);
+			p->tag_len = 0;
+			continue;
+		}
+
+		/* not a tag after all, the bytes are pixels */
+		n = p->tag_len;
+		memcpy(pixels, p->tag, n);
+		p->tag_len = 0;
+		if (!p->width) {
+			pthread_mutex_lock(&stats_lock);
+			stats.junk_bytes += n;
+			pthread_mutex_unlock(&stats_lock);
+			continue;
+		}
+		p->need = (unsigned long long)p->width * p->height * 2;
+		parse(p, pixels, n);
+	}
+}
+
+static int ep_read(int handle, struct gadget_io *io, unsigned int len)
+{
+	io->ep = handle;
+	io->flags = 0;
+	io->length = len;
+
+	return ioctl(fd, USB_RAW_IOCTL_EP_READ, io);
+}
+
+static void *data_thread(void *arg)
+{
+	struct gadget_parser parser = { .tag_len = 0 };
+	struct gadget_io *io;
+	int ret;
+
+	(void)arg;
+
+	io = malloc(sizeof(*io));
+	if (!io)
+		die("malloc");
+
+	for (;;) {
+		ret = ep_read(ep_data_handle, io, DATA_READ_SIZE);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("data endpoint");
+			break;
+		}
+		parse(&parser, io->data, ret);
+	}
+
+	free(io);
+	return NULL;
+}
+
+static void misc_reply(struct gadget_io *io)
+{
+	STATUSLINK_INFO info;
+	unsigned int len = SL_TAG_LEN;
+
+	memset(&info, 0, sizeof(info));
+	info.firmware_version = 1;
+	info.panellink_version = 1;
+	info.statuslink_version = 1;
+	info.os_version = os_version;
+	snprintf((char *)info.sn, sizeof(info.sn), "EMU%08x", (unsigned int)getpid());
+	info.screen_resolution_x = width;
+	info.screen_resolution_y = height;
+	info.max_brightness = 100;
+	info.current_brightness = 100;
+
+	if (fillSLGetInfo(io->data, &len))
+		return;
+	memcpy(io->data + len, &info, sizeof(info));
+
+	io->ep = ep_misc_in_handle;
+	io->flags = 0;
+	io->length = len + sizeof(info);
+	if (ioctl(fd, USB_RAW_IOCTL_EP_WRITE, io) < 0)
+		perror("misc endpoint write");
+}
+
+static void *misc_thread(void *arg)
+{
+	struct gadget_io *io;
+	int ret;
+
+	(void)arg;
+
+	io = malloc(sizeof(*io));
+	if (!io)
+		die("malloc");
+
+	for (;;) {
+		ret = ep_read(ep_misc_out_handle, io, MISC_READ_SIZE);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("misc endpoint");
+			break;
+		}
+
+		pthread_mutex_lock(&stats_lock);
+		stats.status_msgs++;
+		pthread_mutex_unlock(&stats_lock);
+
+		if (ret < SL_TAG_LEN || memcmp(io->data, SL_NAME, SL_NAME_LEN) ||
+		    csum(io->data, SL_TAG_LEN) != 0xffff) {
+			fprintf(stderr, "ignoring %d bytes that are not StatusLink\n", ret);
+			continue;
+		}
+		if (io->data[SL_NAME_LEN + 1] == SL_TYPE_GET_INFO)
+			misc_reply(io);
+	}
+
+	free(io);
+	return NULL;
+}
+
+static void configure(void)
+{
+	static int configured;
+	pthread_t thread;
+	__u32 power = 100;
+
+	if (configured)
+		return;
+	configured = 1;
+
+	ep_data_handle = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, &ep_descs[0]);
+	ep_misc_out_handle = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, &ep_descs[1]);
+	ep_misc_in_handle = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, &ep_descs[2]);
+	if (ep_data_handle < 0 || ep_misc_out_handle < 0 || ep_misc_in_handle < 0)
+		die("enabling endpoints, does the UDC have ep1out, ep2out and ep2in bulk?");
+
+	if (ioctl(fd, USB_RAW_IOCTL_VBUS_DRAW, power) < 0)
+		die("USB_RAW_IOCTL_VBUS_DRAW");
+	if (ioctl(fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+		die("USB_RAW_IOCTL_CONFIGURE");
+
+	if (pthread_create(&thread, NULL, data_thread, NULL) ||
+	    pthread_create(&thread, NULL, misc_thread, NULL))
+		die("pthread_create");
+}
+
+/* answer a request on ep0, returns the reply length, or -1 to stall */
+static int control(const struct usb_ctrlrequest *ctrl, unsigned char *buf)
+{
+	unsigned int value = le16toh(ctrl->wValue);
+
+	if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_STANDARD)
+		return -1;
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (value >> 8) {
+		case USB_DT_DEVICE:
+			memcpy(buf, &device_desc, sizeof(device_desc));
+			return sizeof(device_desc);
+		case USB_DT_DEVICE_QUALIFIER:
+			memcpy(buf, &qualifier_desc, sizeof(qualifier_desc));
+			return sizeof(qualifier_desc);
+		case USB_DT_CONFIG:
+			return config_desc(buf);
+		case USB_DT_STRING:
+			return string_desc(buf, value & 0xff);
+		}
+		return -1;
+	case USB_REQ_SET_CONFIGURATION:
+		configure();
+		return 0;
+	case USB_REQ_SET_INTERFACE:
+		return 0;
+	case USB_REQ_GET_STATUS:
+		buf[0] = 1;	/* self powered */
+		buf[1] = 0;
+		return 2;
+	}
+
+	return -1;
+}
+
+static void *ep0_thread(void *arg)
+{
+	struct gadget_event event;
+	struct {
+		__u16	ep;
+		__u16	flags;
+		__u32	length;
+		__u8	data[EP0_SIZE];
+	} io;
+	unsigned int wlength;
+	int len;
+
+	(void)arg;
+
+	for (;;) {
+		event.type = 0;
+		event.length = sizeof(event.ctrl);
+		if (ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0)
+			die("USB_RAW_IOCTL_EVENT_FETCH");
+		if (event.type != USB_RAW_EVENT_CONTROL)
+			continue;
+
+		len = control(&event.ctrl, io.data);
+		if (len < 0) {
+			ioctl(fd, USB_RAW_IOCTL_EP0_STALL, 0);
+			continue;
+		}
+
+		wlength = le16toh(event.ctrl.wLength);
+		io.ep = 0;
+		io.flags = 0;
+		if (event.ctrl.bRequestType & USB_DIR_IN) {
+			io.length = (unsigned int)len < wlength ? (unsigned int)len : wlength;
+			if (ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0)
+				perror("USB_RAW_IOCTL_EP0_WRITE");
+		} else {
+			io.length = wlength < EP0_SIZE ? wlength : EP0_SIZE;
+			if (ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io) < 0)
+				perror("USB_RAW_IOCTL_EP0_READ");
+		}
+	}
+
+	return NULL;
+}
+
+static void report(const struct gadget_stats *s, const struct gadget_stats *prev, double secs)
+{
+	unsigned long long uploads = s->uploads - prev->uploads;
+	unsigned long long bytes = s->pixel_bytes - prev->pixel_bytes;
+
+	printf("%8.1f uploads/s %7.1f full/s %8.2f MB/s %10.0f bytes/upload %7.1f tags/s  %dx%d\n",
+	       uploads / secs, (s->full - prev->full) / secs, bytes / secs / 1e6,
+	       uploads ? (double)bytes / uploads : 0.0, (s->tags - prev->tags) / secs,
+	       cur_width, cur_height);
+	fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-m os_version] [-W width] [-H height] [-u udc_driver] [-d udc_device]\n"
+		"          [-i interval_s] [-t duration_s]\n"
+		"  os_version picks the model the driver drives (0 Model 5, 16 Model 6S, ...);\n"
+		"  width and height must match it for full/s. Defaults: 0, 800x480,\n"
+		"  dummy_udc on dummy_udc.0, reports every second, runs until killed.\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *udc_driver = "dummy_udc", *udc_device = "dummy_udc.0";
+	struct gadget_stats cur, prev, first;
+	struct usb_raw_init init;
+	double interval = 1, duration = 0, start, last, t;
+	pthread_t thread;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:W:H:u:d:i:t:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			os_version = strtol(optarg, NULL, 0);
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'u':
+			udc_driver = optarg;
+			break;
+		case 'd':
+			udc_device = optarg;
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (interval <= 0)
+		usage(argv[0]);
+
+	fd = open("/dev/raw-gadget", O_RDWR);
+	if (fd < 0)
+		die("/dev/raw-gadget");
+
+	memset(&init, 0, sizeof(init));
+	strncpy((char *)init.driver_name, udc_driver, UDC_NAME_LENGTH_MAX - 1);
+	strncpy((char *)init.device_name, udc_device, UDC_NAME_LENGTH_MAX - 1);
+	init.speed = USB_SPEED_HIGH;
+	if (ioctl(fd, USB_RAW_IOCTL_INIT, &init) < 0)
+		die("USB_RAW_IOCTL_INIT");
+	if (ioctl(fd, USB_RAW_IOCTL_RUN, 0) < 0)
+		die("USB_RAW_IOCTL_RUN");
+
+	if (pthread_create(&thread, NULL, ep0_thread, NULL))
+		die("pthread_create");
+
+	memset(&prev, 0, sizeof(prev));
+	first = prev;
+	start = last = now();
+	for (;;) {
+		usleep(interval * 1e6);
+
+		pthread_mutex_lock(&stats_lock);
+		cur = stats;
+		pthread_mutex_unlock(&stats_lock);
+
+		t = now();
+		report(&cur, &prev, t - last);
+		prev = cur;
+		last = t;
+
+		if (duration && t - start >= duration)
+			break;
+	}
+
+	printf("total: %llu uploads (%llu full screen), %llu pixel bytes, %llu start tags, "
+	       "%llu other tags, %llu stray bytes, %llu StatusLink messages\n",
+	       cur.uploads, cur.full, cur.pixel_bytes, cur.tags, cur.other_tags,
+	       cur.junk_bytes, cur.status_msgs);
+	report(&cur, &first, t - start);
+
+	return 0;
+}
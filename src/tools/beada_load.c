@@ -0,0 +1,358 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Damage load generator for the driver: a bare KMS client that puts a dumb
+ * buffer on the panel and marks it dirty in a loop, with one of a few
+ * damage patterns. Each DIRTYFB is a blocking atomic commit, so the rate it
+ * reports is what the driver sustains; tools/beada_gadget reports what
+ * reached the emulated panel.
+ *   make -C src load && sudo src/user/beada_load -c /dev/dri/card1 -p cursor
+ *
+ * Needs only the kernel's DRM uapi headers, not libdrm.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <drm/drm.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_mode.h>
+
+#define LOAD_MAX_RECTS		8
+#define LOAD_CURSOR_SIZE	64
+#define LOAD_TICKER_ROWS	32
+
+enum load_pattern {
+	LOAD_FULL,	/* new content, whole screen */
+	LOAD_IDLE,	/* same content, whole screen, as idle compositors do */
+	LOAD_CURSOR,	/* a 64x64 square moving across the screen */
+	LOAD_TICKER,	/* a band at the bottom scrolling */
+	LOAD_RANDOM,	/* a few rects of random size and place */
+};
+
+static const char *const pattern_names[] = {
+	[LOAD_FULL]	= "full",
+	[LOAD_IDLE]	= "idle",
+	[LOAD_CURSOR]	= "cursor",
+	[LOAD_TICKER]	= "ticker",
+	[LOAD_RANDOM]	= "random",
+};
+
+struct load_fb {
+	uint32_t	fb_id;
+	uint32_t	handle;
+	uint32_t	pitch;
+	uint32_t	width;
+	uint32_t	height;
+	uint64_t	size;
+	uint32_t	*map;
+};
+
+static int fd;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(EXIT_FAILURE);
+}
+
+static void drm_ioctl(unsigned long request, void *arg, const char *what)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret < 0)
+		die(what);
+}
+
+/* the first connected connector, its preferred mode and a CRTC for it */
+static void find_output(uint32_t *conn_id, uint32_t *crtc_id, struct drm_mode_modeinfo *mode)
+{
+	struct drm_mode_card_res res;
+	struct drm_mode_get_connector conn;
+	struct drm_mode_modeinfo *modes;
+	uint32_t *conns, *crtcs;
+	unsigned int i, j;
+
+	memset(&res, 0, sizeof(res));
+	drm_ioctl(DRM_IOCTL_MODE_GETRESOURCES, &res, "DRM_IOCTL_MODE_GETRESOURCES");
+	if (!res.count_connectors || !res.count_crtcs) {
+		fprintf(stderr, "no connectors or CRTCs, not a KMS device?\n");
+		exit(EXIT_FAILURE);
+	}
+
+	conns = calloc(res.count_connectors, sizeof(*conns));
+	crtcs = calloc(res.count_crtcs, sizeof(*crtcs));
+	if (!conns || !crtcs)
+		die("calloc");
+	res.connector_id_ptr = (uintptr_t)conns;
+	res.crtc_id_ptr = (uintptr_t)crtcs;
+	res.count_fbs = 0;
+	res.count_encoders = 0;
+	drm_ioctl(DRM_IOCTL_MODE_GETRESOURCES, &res, "DRM_IOCTL_MODE_GETRESOURCES");
+
+	for (i = 0; i < res.count_connectors; i++) {
+		memset(&conn, 0, sizeof(conn));
+		conn.connector_id = conns[i];
+		drm_ioctl(DRM_IOCTL_MODE_GETCONNECTOR, &conn, "DRM_IOCTL_MODE_GETCONNECTOR");
+		if (conn.connection != 1 || !conn.count_modes)
+			continue;
+
+		modes = calloc(conn.count_modes, sizeof(*modes));
+		if (!modes)
+			die("calloc");
+		conn.modes_ptr = (uintptr_t)modes;
+		conn.count_props = 0;
+		conn.count_encoders = 0;
+		drm_ioctl(DRM_IOCTL_MODE_GETCONNECTOR, &conn, "DRM_IOCTL_MODE_GETCONNECTOR");
+
+		*mode = modes[0];
+		for (j = 0; j < conn.count_modes; j++) {
+			if (modes[j].type & DRM_MODE_TYPE_PREFERRED) {
+				*mode = modes[j];
+				break;
+			}
+		}
+
+		*conn_id = conns[i];
+		*crtc_id = crtcs[0];
+		free(modes);
+		free(conns);
+		free(crtcs);
+		return;
+	}
+
+	fprintf(stderr, "no connected connector\n");
+	exit(EXIT_FAILURE);
+}
+
+static void fb_create(struct load_fb *fb, uint32_t width, uint32_t height)
+{
+	struct drm_mode_create_dumb create;
+	struct drm_mode_map_dumb map;
+	struct drm_mode_fb_cmd2 cmd;
+
+	memset(&create, 0, sizeof(create));
+	create.width = width;
+	create.height = height;
+	create.bpp = 32;
+	drm_ioctl(DRM_IOCTL_MODE_CREATE_DUMB, &create, "DRM_IOCTL_MODE_CREATE_DUMB");
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.width = width;
+	cmd.height = height;
+	cmd.pixel_format = DRM_FORMAT_XRGB8888;
+	cmd.handles[0] = create.handle;
+	cmd.pitches[0] = create.pitch;
+	drm_ioctl(DRM_IOCTL_MODE_ADDFB2, &cmd, "DRM_IOCTL_MODE_ADDFB2");
+
+	memset(&map, 0, sizeof(map));
+	map.handle = create.handle;
+	drm_ioctl(DRM_IOCTL_MODE_MAP_DUMB, &map, "DRM_IOCTL_MODE_MAP_DUMB");
+
+	fb->map = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map.offset);
+	if (fb->map == MAP_FAILED)
+		die("mmap");
+
+	fb->fb_id = cmd.fb_id;
+	fb->handle = create.handle;
+	fb->pitch = create.pitch;
+	fb->width = width;
+	fb->height = height;
+	fb->size = create.size;
+	memset(fb->map, 0, fb->size);
+}
+
+static void fb_destroy(struct load_fb *fb)
+{
+	struct drm_mode_destroy_dumb destroy = { .handle = fb->handle };
+
+	munmap(fb->map, fb->size);
+	drm_ioctl(DRM_IOCTL_MODE_RMFB, &fb->fb_id, "DRM_IOCTL_MODE_RMFB");
+	drm_ioctl(DRM_IOCTL_MODE_DESTROY_DUMB, &destroy, "DRM_IOCTL_MODE_DESTROY_DUMB");
+}
+
+static void fb_fill(struct load_fb *fb, const struct drm_clip_rect *rect, uint32_t color)
+{
+	uint32_t *row;
+	int x, y;
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		row = fb->map + y * (fb->pitch / 4);
+		for (x = rect->x1; x < rect->x2; x++)
+			row[x] = color ^ (x << 8) ^ y;
+	}
+}
+
+static void rect_set(struct drm_clip_rect *rect, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+	rect->x1 = x;
+	rect->y1 = y;
+	rect->x2 = x + w;
+	rect->y2 = y + h;
+}
+
+/* draw frame @n of @pattern, returns the number of damage rects */
+static unsigned int draw(struct load_fb *fb, enum load_pattern pattern, unsigned int n,
+			 unsigned int nrects, struct drm_clip_rect *rects)
+{
+	uint32_t color = n * 0x010203;
+	uint32_t w, h, span;
+	unsigned int i;
+
+	switch (pattern) {
+	case LOAD_FULL:
+		rect_set(&rects[0], 0, 0, fb->width, fb->height);
+		fb_fill(fb, &rects[0], color);
+		return 1;
+	case LOAD_IDLE:
+		rect_set(&rects[0], 0, 0, fb->width, fb->height);
+		if (!n)
+			fb_fill(fb, &rects[0], 0x336699);
+		return 1;
+	case LOAD_CURSOR:
+		span = fb->width - LOAD_CURSOR_SIZE;
+		rect_set(&rects[0], (n * 8) % span, (fb->height - LOAD_CURSOR_SIZE) / 2,
+			 LOAD_CURSOR_SIZE + 8, LOAD_CURSOR_SIZE);
+		fb_fill(fb, &rects[0], 0);
+		rect_set(&rects[1], rects[0].x1 + 8, rects[0].y1, LOAD_CURSOR_SIZE, LOAD_CURSOR_SIZE);
+		fb_fill(fb, &rects[1], 0xffffff);
+		return 1;
+	case LOAD_TICKER:
+		rect_set(&rects[0], 0, fb->height - LOAD_TICKER_ROWS, fb->width, LOAD_TICKER_ROWS);
+		fb_fill(fb, &rects[0], color);
+		return 1;
+	case LOAD_RANDOM:
+		for (i = 0; i < nrects; i++) {
+			w = 1 + rand() % (fb->width / 4);
+			h = 1 + rand() % (fb->height / 4);
+			rect_set(&rects[i], rand() % (fb->width - w + 1), rand() % (fb->height - h + 1),
+				 w, h);
+			fb_fill(fb, &rects[i], color + i);
+		}
+		return nrects;
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"usage: %s [-c card] [-p pattern] [-r rects] [-n frames] [-t duration_s]\n"
+		"  patterns:", name);
+	for (i = 0; i < sizeof(pattern_names) / sizeof(pattern_names[0]); i++)
+		fprintf(stderr, " %s", pattern_names[i]);
+	fprintf(stderr, "\n  defaults: /dev/dri/card0, full, 4 rects, runs for 10 s\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct drm_clip_rect rects[LOAD_MAX_RECTS];
+	enum load_pattern pattern = LOAD_FULL;
+	const char *card = "/dev/dri/card0";
+	struct drm_mode_fb_dirty_cmd dirty;
+	struct drm_mode_modeinfo mode;
+	double duration = 10, start, t, busy = 0;
+	unsigned long long damage = 0;
+	unsigned int nrects = 4, frames = 0, n, i;
+	struct drm_mode_crtc crtc;
+	uint32_t conn_id, crtc_id;
+	struct load_fb fb;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:p:r:n:t:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			card = optarg;
+			break;
+		case 'p':
+			for (i = 0; i < sizeof(pattern_names) / sizeof(pattern_names[0]); i++)
+				if (!strcmp(optarg, pattern_names[i]))
+					break;
+			if (i == sizeof(pattern_names) / sizeof(pattern_names[0]))
+				usage(argv[0]);
+			pattern = i;
+			break;
+		case 'r':
+			nrects = atoi(optarg);
+			if (!nrects || nrects > LOAD_MAX_RECTS)
+				usage(argv[0]);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 't':
+			duration = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	fd = open(card, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		die(card);
+	if (ioctl(fd, DRM_IOCTL_SET_MASTER, 0) < 0)
+		fprintf(stderr, "not DRM master, is a compositor running on %s?\n", card);
+
+	find_output(&conn_id, &crtc_id, &mode);
+	fb_create(&fb, mode.hdisplay, mode.vdisplay);
+
+	memset(&crtc, 0, sizeof(crtc));
+	crtc.crtc_id = crtc_id;
+	crtc.fb_id = fb.fb_id;
+	crtc.set_connectors_ptr = (uintptr_t)&conn_id;
+	crtc.count_connectors = 1;
+	crtc.mode = mode;
+	crtc.mode_valid = 1;
+	drm_ioctl(DRM_IOCTL_MODE_SETCRTC, &crtc, "DRM_IOCTL_MODE_SETCRTC");
+
+	printf("%s: %ux%u, pattern %s\n", card, fb.width, fb.height, pattern_names[pattern]);
+
+	start = now();
+	for (n = 0; frames ? n < frames : now() - start < duration; n++) {
+		memset(&dirty, 0, sizeof(dirty));
+		dirty.fb_id = fb.fb_id;
+		dirty.num_clips = draw(&fb, pattern, n, nrects, rects);
+		dirty.clips_ptr = (uintptr_t)rects;
+		for (i = 0; i < dirty.num_clips; i++)
+			damage += (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1) * 2;
+
+		t = now();
+		drm_ioctl(DRM_IOCTL_MODE_DIRTYFB, &dirty, "DRM_IOCTL_MODE_DIRTYFB");
+		busy += now() - t;
+	}
+	t = now() - start;
+
+	printf("%u commits in %.2f s: %.1f commits/s, %.2f ms per commit, %.0f damage bytes per commit (RGB565)\n",
+	       n, t, n / t, n ? busy * 1e3 / n : 0.0, n ? (double)damage / n : 0.0);
+
+	fb_destroy(&fb);
+	close(fd);
+
+	return 0;
+}
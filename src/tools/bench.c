@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Microbenchmark of the PanelLink/StatusLink message builders and parser,
+ * linked against libbeadaproto.a:
+ *   make -C src bench && src/user/bench [iterations]
+ *
+ * checksum16() is private to the protocol code; fillPLEnd() builds a tag
+ * without a format string, so its time is the tag header plus checksum.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../panelLinkProtocol.h"
+#include "../statusLinkProtocol.h"
+
+#define BENCH_BUF_SIZE	512
+
+static unsigned char buf[BENCH_BUF_SIZE] __attribute__((aligned(8)));
+static volatile unsigned int sink;
+
+static const char *const formats[] = {
+	"video/x-raw, format=RGB16, height=480, width=800, framerate=0/1",
+	"video/x-raw, format=RGB16, height=64, width=64, framerate=0/1",
+	"video/x-raw, format=RGB16, height=480, width=1280, framerate=0/1",
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double start, unsigned long iterations)
+{
+	printf("%-28s %8.1f ns/op\n", name, (now_ns() - start) / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long i, iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	STATUSLINK_INFO info;
+	unsigned int len;
+	double start;
+
+	if (!iterations)
+		iterations = 1;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		len = sizeof(buf);
+		if (fillPLStart(buf, &len, formats[i % 3]))
+			return 1;
+		sink += len;
+	}
+	report("fillPLStart", start, iterations);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		len = sizeof(buf);
+		if (fillPLEnd(buf, &len))
+			return 1;
+		sink += len;
+	}
+	report("fillPLEnd (checksum16)", start, iterations);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		len = sizeof(buf);
+		if (fillSLGetInfo(buf, &len))
+			return 1;
+		sink += len;
+	}
+	report("fillSLGetInfo", start, iterations);
+
+	/* a reply is the request header followed by the panel's info */
+	memset(buf, 0, sizeof(buf));
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (retrivSLGetInfo(buf, sizeof(buf), &info))
+			return 1;
+		sink += info.os_version;
+	}
+	report("retrivSLGetInfo", start, iterations);
+
+	return 0;
+}
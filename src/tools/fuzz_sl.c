@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * libFuzzer target for the StatusLink reply parser and the PanelLink and
+ * StatusLink message builders, linked against libbeadaproto.a:
+ *   make -C src fuzz CC=clang && src/user/fuzz_sl corpus/
+ *
+ * The first input byte picks the function, the rest is its input. Built
+ * with BEADA_FUZZ_MAIN it replays inputs from files without libFuzzer.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../panelLinkProtocol.h"
+#include "../statusLinkProtocol.h"
+
+#define FUZZ_BUF_SIZE	1024
+
+/* tags are parsed in place as packed structs of 16 bit words */
+static unsigned char buf[FUZZ_BUF_SIZE] __attribute__((aligned(8)));
+
+static void fuzz_check(int cond)
+{
+	if (!cond)
+		abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char fmt[FUZZ_BUF_SIZE + 1];
+	STATUSLINK_INFO info;
+	unsigned int len, room;
+	int ret;
+
+	if (!size)
+		return 0;
+
+	/* builders get a buffer of the size the input asks for */
+	room = size > 1 ? data[1] * 4 : 0;
+	size = size - 1 > FUZZ_BUF_SIZE ? FUZZ_BUF_SIZE : size - 1;
+	memset(buf, 0xa5, sizeof(buf));
+
+	switch (data[0] % 4) {
+	case 0:
+		/* a short or garbled reply must be rejected, not read past */
+		memcpy(buf, data + 1, size);
+		ret = retrivSLGetInfo(buf, size, &info);
+		fuzz_check(ret == 0 || ret == -1);
+		break;
+	case 1:
+		memcpy(fmt, data + 1, size);
+		fmt[size] = '\0';
+		len = room;
+		ret = fillPLStart(buf, &len, fmt);
+		fuzz_check(ret || len <= room);
+		fuzz_check(ret || !strncmp((char *)buf + 12, fmt, 256));
+		break;
+	case 2:
+		len = room;
+		ret = fillSLGetInfo(buf, &len);
+		fuzz_check(ret || len <= room);
+		break;
+	case 3:
+		len = room;
+		ret = fillSLSetBL(buf, &len, size ? data[1] : 0);
+		fuzz_check(ret || len <= room);
+		break;
+	}
+
+	return 0;
+}
+
+#ifdef BEADA_FUZZ_MAIN
+int main(int argc, char **argv)
+{
+	static uint8_t input[FUZZ_BUF_SIZE + 1];
+	size_t size;
+	FILE *f;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		f = fopen(argv[i], "rb");
+		if (!f) {
+			perror(argv[i]);
+			return 1;
+		}
+		size = fread(input, 1, sizeof(input), f);
+		fclose(f);
+		LLVMFuzzerTestOneInput(input, size);
+	}
+
+	return 0;
+}
+#endif